@@ -0,0 +1,89 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: BenchUtils.h 1 2021-04-10 15:02:44Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __BENCHUTILS_H__
+#  define __BENCHUTILS_H__
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <PoolMetrics.h>
+
+namespace bench
+{
+  /**
+   * @return CLOCK_MONOTONIC nanoseconds.
+   **/
+  inline const uint64_t now()
+  {
+    return ::itc::TaskClock::nanoseconds();
+  }
+
+  /**
+   * @brief latencies in nanoseconds, recorded from any thread into the
+   * pool's own HDR histogram.
+   **/
+  class Latency
+  {
+   private:
+    std::unique_ptr<::itc::LatencyHistogram> mHistogram;
+
+   public:
+    explicit Latency() : mHistogram(new ::itc::LatencyHistogram()){}
+
+    void record(const uint64_t ns)
+    {
+      mHistogram->record(ns);
+    }
+
+    const ::itc::histogram get() const
+    {
+      ::itc::histogram result;
+      mHistogram->copy(result, 1.0);
+      return result;
+    }
+  };
+
+  /**
+   * @return the first command line argument as a count, or the default.
+   **/
+  inline const size_t count(const int argc, char** argv, const size_t defaults)
+  {
+    if(argc > 1)
+    {
+      const long long value = std::atoll(argv[1]);
+      if(value > 0)
+        return size_t(value);
+    }
+    return defaults;
+  }
+
+  /**
+   * @brief prints p50/p99/p999 and max in microseconds.
+   **/
+  inline void printLatency(const ::itc::histogram& latency)
+  {
+    std::printf(
+      " %9.1f %9.1f %9.1f %10.1f",
+      double(latency.percentile(0.5)) / 1000.0, double(latency.percentile(0.99)) / 1000.0,
+      double(latency.percentile(0.999)) / 1000.0, double(latency.max) / 1000.0
+    );
+  }
+
+  inline void printLatencyHeader()
+  {
+    std::printf(" %9s %9s %9s %10s", "p50,us", "p99,us", "p999,us", "max,us");
+  }
+}
+
+#endif /* __BENCHUTILS_H__ */
@@ -0,0 +1,116 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: dispatch_bench.cpp 1 2021-04-11 10:12:37Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief ThreadPool dispatch modes: enqueue-to-start latency of the tasks
+ * enqueued one at a time (the pool is idle in between) and throughput of
+ * a burst, for POLL with the shakePools() cadence of ThreadPoolManager and
+ * for PULL. POLL may not drain a large burst in reasonable time, so the
+ * throughput counts the tasks done within BURST_NS.
+ *
+ * Usage: dispatch_bench [tasks]
+ **/
+
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <ThreadPool.h>
+#include "BenchUtils.h"
+
+namespace
+{
+  const size_t THREADS = 4;
+  const useconds_t SHAKE_US = 10000;
+  const uint64_t BURST_NS = 5000000000ULL;
+
+  struct Task : public ::itc::abstract::IRunnable
+  {
+    uint64_t             enqueued;
+    bench::Latency*      latency;
+    std::atomic<size_t>& done;
+
+    explicit Task(std::atomic<size_t>& counter) : enqueued(0), latency(nullptr), done(counter){}
+
+    void execute()
+    {
+      if(latency != nullptr)
+        latency->record(bench::now() - enqueued);
+      ++done;
+    }
+
+    void onCancel(){}
+    void shutdown(){}
+  };
+
+  void run(const ::itc::ThreadPool::DispatchMode mode, const char* name, const size_t tasks)
+  {
+    ::itc::ThreadPool pool(THREADS, false, 1, mode);
+    std::atomic<bool> shaking{true};
+    std::thread shaker([&](){
+      while(shaking)
+      {
+        pool.shakePools();
+        usleep(SHAKE_US);
+      }
+    });
+
+    std::atomic<size_t> done{0};
+    bench::Latency latency;
+    const size_t sparse = std::min(tasks, size_t(1000));
+
+    for(size_t i = 0; i < sparse; ++i)
+    {
+      auto task = std::make_shared<Task>(done);
+      task->latency = &latency;
+      task->enqueued = bench::now();
+      pool.enqueue(task);
+      while(done <= i)
+        std::this_thread::yield();
+      usleep(200);
+    }
+
+    std::vector<::itc::ThreadPool::value_type> burst;
+    burst.reserve(tasks);
+    for(size_t i = 0; i < tasks; ++i)
+      burst.push_back(std::make_shared<Task>(done));
+
+    const uint64_t started = bench::now();
+    for(const auto& task : burst)
+      pool.enqueue(task);
+    while((done < sparse + tasks)&&(bench::now() - started < BURST_NS))
+      usleep(100);
+    const double seconds = double(bench::now() - started) / 1e9;
+    const size_t completed = done - sparse;
+
+    shaking = false;
+    shaker.join();
+    pool.stopPool();
+
+    std::printf("%-6s %12.0f", name, double(completed) / seconds);
+    bench::printLatency(latency.get());
+    std::printf("\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t tasks = bench::count(argc, argv, 200000);
+
+  std::printf("%-6s %12s", "mode", "tasks/s");
+  bench::printLatencyHeader();
+  std::printf("   (enqueue to start, one task at a time)\n");
+
+  run(::itc::ThreadPool::POLL, "POLL", tasks);
+  run(::itc::ThreadPool::PULL, "PULL", tasks);
+  return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: queue_bench.cpp 1 2021-04-10 15:10:08Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief throughput and send-to-receive latency of the queue backends
+ * through QueueAdapter, for several producer/consumer counts, payload
+ * sizes and both block policies.
+ *
+ * Usage: queue_bench [messages per run]
+ **/
+
+#include <sched.h>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <QueueAdapter.h>
+#include "BenchUtils.h"
+
+namespace
+{
+  const size_t CAPACITY = 1024;
+
+  template <size_t SIZE> struct Payload
+  {
+    uint64_t sent;
+    char     data[SIZE - sizeof(uint64_t)];
+  };
+
+  template <typename T> void send(::itc::QueueInterface<T>& queue, const T& msg)
+  {
+    // false means full (busy) with ASYNC
+    while(!queue.send(msg))
+      sched_yield();
+  }
+
+  template <typename T> void recv(::itc::QueueInterface<T>& queue, T& msg)
+  {
+    // false means empty with ASYNC
+    while(!queue.recv(msg))
+      sched_yield();
+  }
+
+  /**
+   * @brief every producer sends messages/producers, every consumer takes
+   * messages/consumers, the totals are rounded down to match.
+   **/
+  template <typename T> void run(
+    const char* backend, const char* policy, ::itc::QueueInterface<T>& queue,
+    const size_t producers, const size_t consumers, const size_t messages)
+  {
+    const size_t perProducer = messages / (producers * consumers) * consumers;
+    const size_t perConsumer = perProducer * producers / consumers;
+    bench::Latency latency;
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < consumers; ++i)
+    {
+      threads.emplace_back([&](){
+        T msg;
+        while(!go) sched_yield();
+        for(size_t n = 0; n < perConsumer; ++n)
+        {
+          recv(queue, msg);
+          latency.record(bench::now() - msg.sent);
+        }
+      });
+    }
+    for(size_t i = 0; i < producers; ++i)
+    {
+      threads.emplace_back([&](){
+        T msg;
+        std::memset(&msg, 0, sizeof(msg));
+        while(!go) sched_yield();
+        for(size_t n = 0; n < perProducer; ++n)
+        {
+          msg.sent = bench::now();
+          send(queue, msg);
+        }
+      });
+    }
+
+    const uint64_t started = bench::now();
+    go = true;
+    for(auto& thread : threads)
+      thread.join();
+    const double seconds = double(bench::now() - started) / 1e9;
+
+    std::printf(
+      "%-10s %-5s %zux%-3zu %6zu %12.0f", backend, policy, producers, consumers, sizeof(T),
+      double(perProducer * producers) / seconds
+    );
+    bench::printLatency(latency.get());
+    std::printf("\n");
+  }
+
+  template <typename Queue, ::itc::QueueBlockPolicy policy, typename... Args> void run(
+    const char* backend, const size_t producers, const size_t consumers, const size_t messages,
+    Args&&... args)
+  {
+    ::itc::QueueAdapter<Queue, policy> queue(std::forward<Args>(args)...);
+    run(backend, (policy == ::itc::SYNC) ? "SYNC" : "ASYNC", queue, producers, consumers, messages);
+  }
+
+  template <typename T, ::itc::QueueBlockPolicy policy> void backends(
+    const size_t producers, const size_t consumers, const size_t messages)
+  {
+    run<::itc::tsbqueue<T>, policy>("tsbqueue", producers, consumers, messages, CAPACITY);
+    run<::itc::cfifo<T, ::itc::MPMC>, policy>("cfifo", producers, consumers, messages, CAPACITY);
+    if((producers == 1)&&(consumers == 1))
+    {
+      run<::itc::cfifo<T, ::itc::SPSC>, policy>("cfifo/SPSC", producers, consumers, messages, CAPACITY);
+    }
+    run<tsqueue<T>, policy>("tsqueue", producers, consumers, messages);
+    run<::itc::lfqueue<T>, policy>("lfqueue", producers, consumers, messages);
+  }
+
+  template <typename T> void payload(const size_t messages)
+  {
+    const size_t threads[][2] = {{1, 1}, {2, 2}, {4, 1}, {1, 4}, {4, 4}};
+    for(const auto& pc : threads)
+    {
+      backends<T, ::itc::ASYNC>(pc[0], pc[1], messages);
+      backends<T, ::itc::SYNC>(pc[0], pc[1], messages);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages = bench::count(argc, argv, 200000);
+
+  std::printf("%-10s %-5s %-5s %6s %12s", "backend", "mode", "PxC", "bytes", "msg/s");
+  bench::printLatencyHeader();
+  std::printf("\n");
+
+  payload<Payload<16>>(messages);
+  payload<Payload<64>>(messages);
+  payload<Payload<256>>(messages);
+  return 0;
+}
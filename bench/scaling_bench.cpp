@@ -0,0 +1,120 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: scaling_bench.cpp 1 2021-04-11 13:26:19Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief ThreadPoolManager scaling strategies under a bursty load: 5ms
+ * tasks arrive at HIGH_RATE and LOW_RATE in turns. Reports how the
+ * thread count follows the load (min, max, mean, changes) and what it
+ * costs in the queue wait.
+ *
+ * Usage: scaling_bench [phase ms]
+ **/
+
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <ThreadPoolManager.h>
+#include "BenchUtils.h"
+
+namespace
+{
+  const size_t PHASES = 6;
+  const size_t HIGH_RATE = 3000; // tasks per second, about 15 busy threads
+  const size_t LOW_RATE = 200;   // about 1 busy thread
+  const useconds_t TASK_US = 5000;
+
+  struct Task : public ::itc::abstract::IRunnable
+  {
+    std::atomic<size_t>& done;
+
+    explicit Task(std::atomic<size_t>& counter) : done(counter){}
+
+    void execute()
+    {
+      usleep(TASK_US);
+      ++done;
+    }
+
+    void onCancel(){}
+    void shutdown(){}
+  };
+
+  void run(const char* name, const std::shared_ptr<::itc::abstract::IScalingStrategy>& strategy, const size_t phaseMs)
+  {
+    std::atomic<size_t> done{0};
+    ::itc::ThreadPoolManager manager(20, 80, 10000, 4);
+    if(strategy)
+      manager.setScalingStrategy(strategy);
+    std::thread thread([&manager](){ manager.execute(); });
+
+    size_t sent = 0, samples = 0, changes = 0, threadsSum = 0;
+    size_t minThreads = ~size_t(0), maxThreads = 0, last = 0;
+
+    for(size_t phase = 0; phase < PHASES; ++phase)
+    {
+      const size_t rate = (phase % 2 == 0) ? HIGH_RATE : LOW_RATE;
+      const uint64_t end = bench::now() + uint64_t(phaseMs) * 1000000;
+      while(bench::now() < end)
+      {
+        manager.enqueueRunnable(std::make_shared<Task>(done));
+        ++sent;
+
+        const ::itc::tpsnapshot snapshot(manager.getSnapshot());
+        if(snapshot.pool.timestamp != 0) // published at least once
+        {
+          const size_t threads = snapshot.pool.tc;
+          if(threads != last)
+          {
+            ++changes;
+            last = threads;
+          }
+          minThreads = std::min(minThreads, threads);
+          maxThreads = std::max(maxThreads, threads);
+          threadsSum += threads;
+          ++samples;
+        }
+
+        usleep(useconds_t(1000000 / rate));
+      }
+    }
+    while(done < sent)
+      usleep(1000);
+
+    // one more publish, so the wait histogram covers all the tasks
+    usleep(20000);
+    const ::itc::tpsnapshot snapshot(manager.getSnapshot());
+    manager.shutdown();
+    thread.join();
+
+    std::printf(
+      "%-10s %7zu %5zu %5zu %7.1f %8zu", name, sent, minThreads, maxThreads,
+      double(threadsSum) / double(std::max(samples, size_t(1))), changes
+    );
+    bench::printLatency(snapshot.wait);
+    std::printf("\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t phaseMs = bench::count(argc, argv, 700);
+
+  std::printf("%-10s %7s %5s %5s %7s %8s", "strategy", "tasks", "min", "max", "mean", "changes");
+  bench::printLatencyHeader();
+  std::printf("   (threads; queue wait)\n");
+
+  run("heuristic", nullptr, phaseMs);
+  run("feedback", std::make_shared<::itc::FeedbackScaling>(4, 100), phaseMs);
+  return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: timer_bench.cpp 1 2021-04-10 18:05:51Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief co-expiring timers in RScheduler: the cost of add() and the
+ * lateness of the runs after the common deadline, per timer backend and
+ * burst size. Then the add()/cancel() rate of several threads against the
+ * shard count; the shards only pay off when the threads run on different
+ * CPUs (or get different shards with fewer CPUs than shards).
+ *
+ * Usage: timer_bench [max timers]
+ **/
+
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <RScheduler.h>
+#include "BenchUtils.h"
+
+namespace
+{
+  const uint32_t OFFSET_MS = 200;
+  const size_t INSERT_OPS = 400000; // add() and cancel() pairs per run
+  const size_t PENDING = 64;        // timers a thread keeps pending
+
+  struct Noop : public ::itc::abstract::IRunnable
+  {
+    void execute(){}
+    void onCancel(){}
+    void shutdown(){}
+  };
+
+  struct Job : public ::itc::abstract::IRunnable
+  {
+    uint64_t             due;
+    bench::Latency&      lateness;
+    std::atomic<size_t>& fired;
+
+    explicit Job(const uint64_t deadline, bench::Latency& latency, std::atomic<size_t>& counter)
+    : due(deadline), lateness(latency), fired(counter){}
+
+    void execute()
+    {
+      const uint64_t current = bench::now();
+      lateness.record(current > due ? current - due : 0);
+      ++fired;
+    }
+
+    void onCancel(){}
+    void shutdown(){}
+  };
+
+  void run(const ::itc::RScheduler::TimerBackend backend, const char* name, const size_t timers)
+  {
+    bench::Latency lateness;
+    std::atomic<size_t> fired{0};
+    auto rs = std::make_shared<::itc::RScheduler>(4, 5, backend);
+    std::thread thread([&rs](){ rs->execute(); });
+
+    std::vector<std::shared_ptr<Job>> jobs;
+    jobs.reserve(timers);
+    const uint64_t due = bench::now() + uint64_t(OFFSET_MS) * 1000000;
+    for(size_t i = 0; i < timers; ++i)
+    {
+      jobs.push_back(std::make_shared<Job>(due, lateness, fired));
+    }
+
+    // all timers share the deadline, the offset of each is what is left
+    // of OFFSET_MS at the time it is added, rounded up to a millisecond
+    const uint64_t started = bench::now();
+    for(const auto& job : jobs)
+    {
+      const uint64_t current = bench::now();
+      rs->add(uint32_t((due > current) ? (due - current + 999999) / 1000000 : 0), job);
+    }
+    const double addNs = double(bench::now() - started) / double(timers);
+
+    while(fired < timers)
+      usleep(1000);
+    rs->onCancel();
+    thread.join();
+
+    std::printf("%-12s %8zu %10.0f", name, timers, addNs);
+    bench::printLatency(lateness.get());
+    std::printf("\n");
+  }
+
+  /**
+   * @brief every thread adds far timers and cancels them PENDING at a
+   * time, so the schedule stays small and nothing fires.
+   **/
+  void inserts(const ::itc::RScheduler::TimerBackend backend, const char* name,
+               const size_t threads, const size_t shards)
+  {
+    auto rs = std::make_shared<::itc::RScheduler>(4, 5, backend, 100, shards);
+    std::thread scheduler([&rs](){ rs->execute(); });
+
+    const size_t perThread = INSERT_OPS / threads / PENDING * PENDING;
+    std::atomic<bool> go{false};
+    std::vector<std::thread> adders;
+
+    for(size_t i = 0; i < threads; ++i)
+    {
+      adders.emplace_back([&](){
+        auto job = std::make_shared<Noop>();
+        std::vector<::itc::RScheduler::TimerHandle> handles;
+        handles.reserve(PENDING);
+        while(!go) std::this_thread::yield();
+        for(size_t n = 0; n < perThread; n += PENDING)
+        {
+          for(size_t k = 0; k < PENDING; ++k)
+            handles.push_back(rs->add(60000, job));
+          for(const auto& handle : handles)
+            rs->cancel(handle);
+          handles.clear();
+        }
+      });
+    }
+
+    const uint64_t started = bench::now();
+    go = true;
+    for(auto& adder : adders)
+      adder.join();
+    const double seconds = double(bench::now() - started) / 1e9;
+
+    rs->onCancel();
+    scheduler.join();
+
+    std::printf("%-12s %8zu %7zu %14.0f\n", name, threads, shards, double(perThread * threads * 2) / seconds);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t max = bench::count(argc, argv, 100000);
+
+  std::printf("%-12s %8s %10s", "backend", "timers", "add,ns");
+  bench::printLatencyHeader();
+  std::printf("   (lateness)\n");
+
+  for(size_t timers = 1000; timers <= max; timers *= 10)
+  {
+    run(::itc::RScheduler::TIMER_MAP, "TIMER_MAP", timers);
+    run(::itc::RScheduler::TIMER_WHEEL, "TIMER_WHEEL", timers);
+  }
+
+  std::printf("\n%u CPUs\n%-12s %8s %7s %14s\n", std::thread::hardware_concurrency(),
+              "backend", "threads", "shards", "add+cancel/s");
+  for(const size_t threads : {1, 2, 4, 8})
+  {
+    for(const size_t shards : {1, 2, 4, 8})
+    {
+      inserts(::itc::RScheduler::TIMER_MAP, "TIMER_MAP", threads, shards);
+      inserts(::itc::RScheduler::TIMER_WHEEL, "TIMER_WHEEL", threads, shards);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: tsbqueue_bench.cpp 1 2021-04-11 11:40:02Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief tsbqueue batched sends: one producer sends the messages one by
+ * one or in batches with send(std::vector), blocked consumers take them
+ * one by one. A batch costs one wake, so the throughput should grow with
+ * the batch size while the consumers sleep between the batches.
+ *
+ * The same runs go through SemaphoreQueue, the semaphore based tsbqueue
+ * this one has replaced, as the baseline, and through an unbounded
+ * tsbqueue to compare with it (ratio is tsbqueue / baseline). The
+ * latency is of the bounded tsbqueue, unbounded it is just the depth of
+ * the backlog.
+ *
+ * Usage: tsbqueue_bench [messages per run]
+ **/
+
+#include <cerrno>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <sys/semaphore.h>
+#include <tsbqueue.h>
+#include "BenchUtils.h"
+
+namespace
+{
+  // bounded, so the producer can't run far ahead and the latency is not
+  // just the depth of the backlog
+  const size_t CAPACITY = 4096;
+
+  struct Message
+  {
+    uint64_t sent;
+    uint64_t payload;
+  };
+
+  /**
+   * @brief the send/recv path of the previous tsbqueue: a mutex protected
+   * std::queue and one semaphore post per message, a batch included.
+   **/
+  template <typename DataType> class SemaphoreQueue
+  {
+   private:
+    std::mutex           mMutex;
+    std::queue<DataType> mQueue;
+    itc::sys::semaphore  mEvent;
+
+   public:
+    SemaphoreQueue() : mMutex(), mQueue(), mEvent{10}
+    {
+    }
+
+    ~SemaphoreQueue()
+    {
+      mEvent.destroy();
+    }
+
+    void send(const DataType&& ref)
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      mQueue.push(std::move(ref));
+      if(!mEvent.post())
+      {
+        throw std::system_error(errno, std::system_category(), "Can't increment semaphore");
+      }
+    }
+
+    void send(const std::vector<DataType>& ref)
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      for(size_t i = 0; i < ref.size(); ++i)
+      {
+        mQueue.push(ref[i]);
+        if(!mEvent.post())
+        {
+          throw std::system_error(errno, std::system_category(), "Can't increment semaphore");
+        }
+      }
+    }
+
+    void recv(DataType& result)
+    {
+      mEvent.wait();
+      std::lock_guard<std::mutex> sync(mMutex);
+      if(mQueue.empty())
+      {
+        throw std::logic_error("SemaphoreQueue<T>::recv(T&) - already consumed");
+      }
+      result = std::move(mQueue.front());
+      mQueue.pop();
+    }
+  };
+
+  /**
+   * @return messages per second, the latency goes to latency.
+   **/
+  template <typename Queue> double run(
+    Queue& queue, bench::Latency& latency, const size_t consumers, const size_t batch, const size_t messages)
+  {
+    const size_t batches = messages / (batch * consumers) * consumers;
+    const size_t perConsumer = batches * batch / consumers;
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < consumers; ++i)
+    {
+      threads.emplace_back([&](){
+        Message msg;
+        for(size_t n = 0; n < perConsumer; ++n)
+        {
+          queue.recv(msg);
+          latency.record(bench::now() - msg.sent);
+        }
+      });
+    }
+
+    const uint64_t started = bench::now();
+    std::vector<Message> pack(batch);
+    for(size_t i = 0; i < batches; ++i)
+    {
+      const uint64_t sent = bench::now();
+      if(batch == 1)
+      {
+        queue.send(Message{sent, i});
+      }else
+      {
+        for(auto& msg : pack)
+          msg.sent = sent;
+        queue.send(pack);
+      }
+    }
+    for(auto& thread : threads)
+      thread.join();
+    const double seconds = double(bench::now() - started) / 1e9;
+
+    return double(batches * batch) / seconds;
+  }
+
+  void compare(const size_t consumers, const size_t batch, const size_t messages)
+  {
+    bench::Latency ignored;
+    SemaphoreQueue<Message> baseline;
+    const double before = run(baseline, ignored, consumers, batch, messages);
+
+    ::itc::tsbqueue<Message> unbounded;
+    const double after = run(unbounded, ignored, consumers, batch, messages);
+
+    bench::Latency latency;
+    ::itc::tsbqueue<Message> bounded(CAPACITY);
+    const double backpressure = run(bounded, latency, consumers, batch, messages);
+
+    std::printf(
+      "%9zu %6zu %12.0f %12.0f %7.2f %12.0f", consumers, batch, before, after, after / before, backpressure
+    );
+    bench::printLatency(latency.get());
+    std::printf("\n");
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages = bench::count(argc, argv, 1000000);
+
+  std::printf("%9s %6s %12s %12s %7s %12s", "consumers", "batch", "sem msg/s", "msg/s", "ratio", "bound msg/s");
+  bench::printLatencyHeader();
+  std::printf("\n");
+
+  for(const size_t consumers : {1, 2, 4})
+  {
+    for(const size_t batch : {1, 16, 256})
+    {
+      compare(consumers, batch, messages);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,234 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: CPUTopology.h 1 2021-03-09 21:02:11Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __CPUTOPOLOGY_H__
+#  define __CPUTOPOLOGY_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <errno.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+namespace itc
+{
+  /**
+   * @brief the NUMA nodes and their CPUs, as they are available to this
+   * process. The topology is read from /sys/devices/system/node without
+   * libnuma. If it is not available, all the CPUs from the process affinity
+   * mask are reported as a single node.
+   *
+   * Use Singleton<CPUTopology>::getInstance() to avoid reading sysfs more
+   * than once.
+   **/
+  class CPUTopology
+  {
+   private:
+    std::vector<std::vector<int>> mNodes;
+    std::vector<int>              mCPUs;
+    std::vector<size_t>           mNodeOf;
+
+    static std::vector<int> parseCPUList(const std::string& list)
+    {
+      std::vector<int> result;
+      std::stringstream ss(list);
+      std::string range;
+
+      while(std::getline(ss, range, ','))
+      {
+        if(range.empty()) continue;
+
+        const size_t dash = range.find('-');
+        const int first = std::atoi(range.substr(0, dash).c_str());
+        const int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+
+        for(int cpu = first; cpu <= last; ++cpu)
+        {
+          result.push_back(cpu);
+        }
+      }
+      return result;
+    }
+
+    static std::vector<int> getAllowedCPUs()
+    {
+      std::vector<int> result;
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+
+      if(sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0)
+      {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+          if(CPU_ISSET(cpu, &cpuset))
+          {
+            result.push_back(cpu);
+          }
+        }
+      }
+      if(result.empty())
+      {
+        const int cpus = std::max(1, int(std::thread::hardware_concurrency()));
+        for(int cpu = 0; cpu < cpus; ++cpu)
+        {
+          result.push_back(cpu);
+        }
+      }
+      return result;
+    }
+
+    static std::vector<int> getNodeIds()
+    {
+      std::vector<int> result;
+      DIR* dir = opendir("/sys/devices/system/node");
+
+      if(dir != nullptr)
+      {
+        struct dirent* entry;
+        while((entry = readdir(dir)) != nullptr)
+        {
+          if((strncmp(entry->d_name, "node", 4) == 0)&&(entry->d_name[4] >= '0')&&(entry->d_name[4] <= '9'))
+          {
+            result.push_back(std::atoi(entry->d_name + 4));
+          }
+        }
+        closedir(dir);
+      }
+      std::sort(result.begin(), result.end());
+      return result;
+    }
+
+   public:
+    explicit CPUTopology() : mNodes(), mCPUs(), mNodeOf()
+    {
+      const std::vector<int> allowed = getAllowedCPUs();
+
+      for(const int node : getNodeIds())
+      {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+
+        if(cpulist.good() && std::getline(cpulist, list))
+        {
+          std::vector<int> cpus;
+          for(const int cpu : parseCPUList(list))
+          {
+            if(std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+            {
+              cpus.push_back(cpu);
+            }
+          }
+          if(!cpus.empty())
+          {
+            mNodes.push_back(std::move(cpus));
+          }
+        }
+      }
+
+      if(mNodes.empty())
+      {
+        mNodes.push_back(allowed);
+      }
+
+      for(size_t node = 0; node < mNodes.size(); ++node)
+      {
+        for(const int cpu : mNodes[node])
+        {
+          mCPUs.push_back(cpu);
+          if(size_t(cpu) >= mNodeOf.size())
+          {
+            mNodeOf.resize(cpu + 1, 0);
+          }
+          mNodeOf[cpu] = node;
+        }
+      }
+    }
+
+    CPUTopology(const CPUTopology&) = delete;
+    CPUTopology(CPUTopology&) = delete;
+
+    /**
+     * @return amount of the NUMA nodes with at least one CPU available
+     * to the process.
+     **/
+    const size_t getNodesCount() const
+    {
+      return mNodes.size();
+    }
+
+    /**
+     * @return the CPUs of the node (the node index is [0..getNodesCount())).
+     **/
+    const std::vector<int>& getCPUs(const size_t node) const
+    {
+      return mNodes[node % mNodes.size()];
+    }
+
+    /**
+     * @return all available CPUs ordered by node.
+     **/
+    const std::vector<int>& getCPUs() const
+    {
+      return mCPUs;
+    }
+
+    const size_t getNodeOf(const int cpu) const
+    {
+      if((cpu >= 0)&&(size_t(cpu) < mNodeOf.size()))
+      {
+        return mNodeOf[cpu];
+      }
+      return 0;
+    }
+
+    /**
+     * @return the node the calling thread is running on right now.
+     **/
+    const size_t getCurrentNode() const
+    {
+      if(mNodes.size() == 1)
+      {
+        return 0;
+      }
+      return getNodeOf(sched_getcpu());
+    }
+
+    /**
+     * @brief binds the calling thread to the set of CPUs.
+     * @return 0 on success, the error code of pthread_setaffinity_np()
+     * otherwise (EINVAL for an empty set).
+     **/
+    static const int bind(const std::vector<int>& cpus)
+    {
+      if(cpus.empty())
+      {
+        return EINVAL;
+      }
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      for(const int cpu : cpus)
+      {
+        CPU_SET(cpu, &cpuset);
+      }
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    }
+  };
+}
+
+#endif /* __CPUTOPOLOGY_H__ */
@@ -0,0 +1,143 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: EventCount.h 1 2021-03-14 12:40:05Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __EVENTCOUNT_H__
+#  define __EVENTCOUNT_H__
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace itc
+{
+  /**
+   * @brief a hint to the CPU, that the thread is spinning.
+   **/
+  inline void cpu_relax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+  }
+
+  /**
+   * @brief futex based event count. The waiter announces itself with
+   * prepareWait(), re-checks its condition and then either calls
+   * cancelWait() or wait(key). The notifier changes the condition first,
+   * then calls notify(), which costs a fence and a load, if there are no
+   * waiters, - no syscalls.
+   *
+   * Usage:
+   *    while(!condition())
+   *    {
+   *      auto key=ec.prepareWait();
+   *      if(condition()) { ec.cancelWait(); break; }
+   *      ec.wait(key);
+   *    }
+   **/
+  class EventCount
+  {
+   private:
+    std::atomic<uint32_t> mEpoch;
+    std::atomic<uint32_t> mWaiters;
+
+    static long futex(std::atomic<uint32_t>* addr, const int op, const uint32_t val,
+                      const ::timespec* timeout = nullptr, const uint32_t bitset = 0)
+    {
+      return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val, timeout, nullptr, bitset);
+    }
+
+    void wake(const int count)
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(mWaiters.load(std::memory_order_relaxed) != 0)
+      {
+        mEpoch.fetch_add(1, std::memory_order_seq_cst);
+        futex(&mEpoch, FUTEX_WAKE_PRIVATE, count);
+      }
+    }
+
+   public:
+    explicit EventCount() : mEpoch{0}, mWaiters{0}{}
+    EventCount(const EventCount&) = delete;
+    EventCount(EventCount&) = delete;
+
+    const uint32_t prepareWait()
+    {
+      mWaiters.fetch_add(1, std::memory_order_seq_cst);
+      return mEpoch.load(std::memory_order_seq_cst);
+    }
+
+    void cancelWait()
+    {
+      mWaiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief blocks until notify() is called after the prepareWait() which
+     * has returned the key.
+     **/
+    void wait(const uint32_t key)
+    {
+      while(mEpoch.load(std::memory_order_acquire) == key)
+      {
+        futex(&mEpoch, FUTEX_WAIT_PRIVATE, key);
+      }
+      mWaiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief same as wait(key), but gives up at the absolute CLOCK_REALTIME
+     * deadline (the sem_timedwait() semantics).
+     *
+     * @return false if the deadline is reached without notification.
+     **/
+    const bool wait(const uint32_t key, const ::timespec& deadline)
+    {
+      bool notified = true;
+      while(mEpoch.load(std::memory_order_acquire) == key)
+      {
+        if((futex(&mEpoch, FUTEX_WAIT_BITSET_PRIVATE|FUTEX_CLOCK_REALTIME, key, &deadline, FUTEX_BITSET_MATCH_ANY) == -1)&&(errno == ETIMEDOUT))
+        {
+          notified = (mEpoch.load(std::memory_order_acquire) != key);
+          break;
+        }
+      }
+      mWaiters.fetch_sub(1, std::memory_order_seq_cst);
+      return notified;
+    }
+
+    void notify()
+    {
+      wake(1);
+    }
+
+    void notifyAll()
+    {
+      wake(INT_MAX);
+    }
+
+    const bool hasWaiters() const
+    {
+      return mWaiters.load() != 0;
+    }
+  };
+}
+
+#endif /* __EVENTCOUNT_H__ */
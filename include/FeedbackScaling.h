@@ -0,0 +1,152 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: FeedbackScaling.h 1 2021-04-02 12:26:31Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __FEEDBACKSCALING_H__
+#  define __FEEDBACKSCALING_H__
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <abstract/IScalingStrategy.h>
+
+namespace itc
+{
+  /**
+   * @brief control loop scaling for the ThreadPoolManager. The arrival rate
+   * (lambda), the task service time (S) and the queue depth (Q) are smoothed
+   * with EWMA, the service time is derived from the busy threads and the
+   * throughput (Little's law, busy = throughput * S). The target is
+   *
+   *    threads = lambda * S / utilization + Q * S / drain_time
+   *
+   * i.e. the threads to serve the arrivals at the target utilization plus
+   * the threads to drain the backlog within drain_time, clamped to
+   * [minthreads, maxthreads].
+   *
+   * The pool grows to the target at once. It shrinks only if the target
+   * stays below current * (1 - hysteresis) for shrink_delay samples in a
+   * row, and by half of the difference at a time, so the bursts don't make
+   * the pool oscillate.
+   **/
+  class FeedbackScaling : public abstract::IScalingStrategy
+  {
+   private:
+    const size_t  mMinThreads;
+    const size_t  mMaxThreads;
+    const double  mAlpha;
+    const double  mUtilization;
+    const double  mDrainTime;
+    const double  mHysteresis;
+    const size_t  mShrinkDelay;
+
+    bool          mPrimed;
+    tpstats       mLast;
+    double        mArrivalRate; // tasks per second
+    double        mServiceTime; // seconds
+    double        mQueueDepth;
+    size_t        mBelow;
+
+    const double ewma(const double average, const double sample) const
+    {
+      return average + mAlpha * (sample - average);
+    }
+
+   public:
+    /**
+     * @param minthreads - the lower limit, not less than the initial size
+     * of the pool
+     * @param maxthreads - the upper limit
+     * @param alpha - EWMA smoothing factor (0..1], higher reacts faster
+     * @param utilization - target share of busy time of the threads (0..1]
+     * @param drain_ms - time to drain the backlog in
+     * @param hysteresis - relative band below the current size where the
+     * pool is not shrunk
+     * @param shrink_delay - samples the target must stay below the band
+     * before the pool is shrunk
+     **/
+    explicit FeedbackScaling(
+      const size_t minthreads, const size_t maxthreads,
+      const double alpha = 0.2, const double utilization = 0.8,
+      const size_t drain_ms = 100, const double hysteresis = 0.2,
+      const size_t shrink_delay = 10
+    ) : mMinThreads(minthreads), mMaxThreads(std::max(minthreads, maxthreads)),
+      mAlpha(alpha), mUtilization(utilization), mDrainTime(double(drain_ms) / 1000),
+      mHysteresis(hysteresis), mShrinkDelay(shrink_delay), mPrimed(false), mLast(),
+      mArrivalRate(0), mServiceTime(0), mQueueDepth(0), mBelow(0)
+    {
+      if((alpha <= 0)||(alpha > 1)||(utilization <= 0)||(utilization > 1)||(drain_ms == 0))
+      {
+        throw std::logic_error("FeedbackScaling::FeedbackScaling() - alpha and utilization must be in (0,1], drain_ms must be > 0");
+      }
+    }
+
+    const ptrdiff_t evaluate(const tpstats& stats)
+    {
+      if(!mPrimed)
+      {
+        mPrimed = true;
+        mLast = stats;
+        mQueueDepth = stats.tqdp;
+        return 0;
+      }
+
+      if(stats.timestamp <= mLast.timestamp)
+      {
+        return 0;
+      }
+
+      const double dt = double(stats.timestamp - mLast.timestamp) / 1e9;
+      const double arrivals = double(stats.enqueued - mLast.enqueued);
+      const double completions = double(stats.completed - mLast.completed);
+      const double busy = double(stats.tac + mLast.tac) / 2;
+
+      mArrivalRate = ewma(mArrivalRate, arrivals / dt);
+      mQueueDepth = ewma(mQueueDepth, double(stats.tqdp));
+
+      if(completions > 0)
+      {
+        mServiceTime = ewma(mServiceTime, busy * dt / completions);
+      }else if(busy > 0)
+      {
+        // nothing completed, the tasks run at least this long
+        mServiceTime = std::max(mServiceTime, busy * dt);
+      }
+      mLast = stats;
+
+      const double demand = mArrivalRate * mServiceTime / mUtilization;
+      const double backlog = mQueueDepth * mServiceTime / mDrainTime;
+      const size_t target = std::max(mMinThreads, size_t(std::min(double(mMaxThreads), std::ceil(demand + backlog))));
+      const size_t current = stats.maxthreads;
+
+      if(target > current)
+      {
+        mBelow = 0;
+        return ptrdiff_t(target - current);
+      }
+
+      if(double(target) < double(current) * (1 - mHysteresis))
+      {
+        if(++mBelow >= mShrinkDelay)
+        {
+          mBelow = 0;
+          return -ptrdiff_t(std::max(size_t(1), (current - target) / 2));
+        }
+      }else
+      {
+        mBelow = 0;
+      }
+      return 0;
+    }
+  };
+}
+
+#endif /* __FEEDBACKSCALING_H__ */
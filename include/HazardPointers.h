@@ -0,0 +1,235 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: HazardPointers.h 1 2021-03-22 20:05:31Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __HAZARDPOINTERS_H__
+#  define __HAZARDPOINTERS_H__
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace itc
+{
+  /**
+   * @brief M.Michael's hazard pointers, the safe memory reclamation for
+   * lock-free containers. A thread publishes the pointer it is going to
+   * dereference with protect(), a removed node is passed to retire() and
+   * is deleted only when no thread has it published.
+   *
+   * Every thread gets a record with HazardPointers::slots hazard pointers
+   * on its first use of the domain. The record is reused by other threads
+   * after the thread exits. The nodes retired by a thread, which are still
+   * protected at its exit, are adopted by the next scan in any thread.
+   *
+   * There is one process wide domain: HazardPointers::instance().
+   **/
+  class HazardPointers
+  {
+   public:
+    static constexpr size_t slots = 2;
+    typedef void (*Deleter)(void*);
+
+   private:
+    struct Record // padded, not aligned: no aligned operator new in C++14
+    {
+      std::atomic<void*>  hazard[slots];
+      std::atomic<bool>   active;
+      Record*             next;
+      char                pad[64];
+
+      explicit Record() : active{true}, next{nullptr}, pad()
+      {
+        for(size_t i=0;i<slots;++i) hazard[i].store(nullptr);
+      }
+    };
+
+    struct Retired
+    {
+      void*   ptr;
+      Deleter deleter;
+    };
+
+    struct ThreadState
+    {
+      Record*               record;
+      std::vector<Retired>  retired;
+
+      explicit ThreadState(Record* ref) : record(ref), retired(){}
+
+      ~ThreadState()
+      {
+        HazardPointers::instance().release(*this);
+      }
+    };
+
+    std::atomic<Record*>    mHead;
+    std::atomic<size_t>     mRecords;
+    std::mutex              mOrphansMutex;
+    std::vector<Retired>    mOrphans;
+    std::atomic<bool>       mHasOrphans;
+
+    explicit HazardPointers() : mHead{nullptr}, mRecords{0}, mOrphansMutex(), mOrphans(), mHasOrphans{false}{}
+
+    Record* acquire()
+    {
+      for(Record* record=mHead.load(std::memory_order_acquire); record != nullptr; record=record->next)
+      {
+        bool expected=false;
+        if((!record->active.load(std::memory_order_relaxed))&&
+            record->active.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          return record;
+        }
+      }
+
+      Record* record=new Record();
+      Record* head=mHead.load(std::memory_order_relaxed);
+      do
+      {
+        record->next=head;
+      }while(!mHead.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+      ++mRecords;
+      return record;
+    }
+
+    void release(ThreadState& state)
+    {
+      for(size_t i=0;i<slots;++i)
+      {
+        state.record->hazard[i].store(nullptr, std::memory_order_release);
+      }
+      scan(state.retired);
+
+      if(!state.retired.empty())
+      {
+        std::lock_guard<std::mutex> sync(mOrphansMutex);
+        mOrphans.insert(mOrphans.end(), state.retired.begin(), state.retired.end());
+        mHasOrphans.store(true);
+      }
+      state.record->active.store(false, std::memory_order_release);
+    }
+
+    ThreadState& local()
+    {
+      thread_local ThreadState state(acquire());
+      return state;
+    }
+
+    const size_t threshold() const
+    {
+      return std::max(size_t(64), 2 * slots * mRecords.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief deletes the retired nodes, which are not published in any
+     * hazard pointer.
+     **/
+    void scan(std::vector<Retired>& retired)
+    {
+      if(mHasOrphans.load(std::memory_order_relaxed))
+      {
+        std::unique_lock<std::mutex> sync(mOrphansMutex, std::try_to_lock);
+        if(sync.owns_lock())
+        {
+          retired.insert(retired.end(), mOrphans.begin(), mOrphans.end());
+          mOrphans.clear();
+          mHasOrphans.store(false);
+        }
+      }
+
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      std::vector<void*> hazards;
+      hazards.reserve(slots * mRecords.load(std::memory_order_relaxed));
+
+      for(Record* record=mHead.load(std::memory_order_acquire); record != nullptr; record=record->next)
+      {
+        for(size_t i=0;i<slots;++i)
+        {
+          void* ptr=record->hazard[i].load(std::memory_order_acquire);
+          if(ptr != nullptr) hazards.push_back(ptr);
+        }
+      }
+      std::sort(hazards.begin(), hazards.end());
+
+      auto protectedEnd=std::partition(retired.begin(), retired.end(),
+        [&hazards](const Retired& node){ return std::binary_search(hazards.begin(), hazards.end(), node.ptr); }
+      );
+
+      for(auto it=protectedEnd; it != retired.end(); ++it)
+      {
+        it->deleter(it->ptr);
+      }
+      retired.erase(protectedEnd, retired.end());
+    }
+
+   public:
+    HazardPointers(const HazardPointers&)=delete;
+    HazardPointers(HazardPointers&)=delete;
+
+    /**
+     * @brief the domain is never destroyed, so the threads exiting after
+     * main() still can release their records.
+     **/
+    static HazardPointers& instance()
+    {
+      static HazardPointers* domain=new HazardPointers();
+      return *domain;
+    }
+
+    /**
+     * @brief publishes the value of src in the slot and makes sure src has
+     * not changed meanwhile.
+     * @return the protected pointer, which may be dereferenced until the
+     * slot is cleared or reused.
+     **/
+    template <typename T> T* protect(const size_t slot, const std::atomic<T*>& src)
+    {
+      std::atomic<void*>& hazard=local().record->hazard[slot];
+      T* ptr=src.load(std::memory_order_relaxed);
+
+      for(;;)
+      {
+        hazard.store(ptr, std::memory_order_seq_cst);
+        T* current=src.load(std::memory_order_seq_cst);
+        if(current == ptr)
+        {
+          return ptr;
+        }
+        ptr=current;
+      }
+    }
+
+    void clear(const size_t slot)
+    {
+      local().record->hazard[slot].store(nullptr, std::memory_order_release);
+    }
+
+    /**
+     * @brief the node is deleted with operator delete, as soon as it is not
+     * protected by any thread.
+     **/
+    template <typename T> void retire(T* ptr)
+    {
+      ThreadState& state=local();
+      state.retired.push_back({ptr, [](void* node){ delete static_cast<T*>(node); }});
+
+      if(state.retired.size() >= threshold())
+      {
+        scan(state.retired);
+      }
+    }
+  };
+}
+
+#endif /* __HAZARDPOINTERS_H__ */
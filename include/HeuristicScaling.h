@@ -0,0 +1,63 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: HeuristicScaling.h 1 2021-04-02 11:40:06Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __HEURISTICSCALING_H__
+#  define __HEURISTICSCALING_H__
+
+#include <cmath>
+#include <abstract/IScalingStrategy.h>
+
+namespace itc
+{
+  /**
+   * @brief the default scaling of the ThreadPoolManager. The pool is
+   * expanded by log2(maxthreads) if there are less than min_thr_ready idle
+   * threads and the queue is 25% longer than the amount of threads, and it
+   * is reduced by one thread (down to maxthreads) if there are more idle
+   * threads than busy ones and the queue is short.
+   **/
+  class HeuristicScaling : public abstract::IScalingStrategy
+  {
+   private:
+    const size_t mMaxThreads;
+    const size_t mOvercommitThreads;
+    const size_t mMinReadyThr;
+
+   public:
+    explicit HeuristicScaling(const size_t maxthreads, const size_t overcommit, const size_t min_thr_ready)
+    : mMaxThreads(maxthreads), mOvercommitThreads(overcommit), mMinReadyThr(min_thr_ready)
+    {
+    }
+
+    const ptrdiff_t evaluate(const tpstats& stats)
+    {
+      if(stats.tpc<mMinReadyThr)
+      {
+        if((stats.tc<(mMaxThreads+mOvercommitThreads)) && (stats.tqdp>(stats.tc*1.25)))
+        {
+          return ptrdiff_t(log2(stats.maxthreads));
+        }
+      }
+
+      if((stats.tpc>mMinReadyThr)&&(stats.tpc>=stats.tac)&&((stats.tqdp*2)<stats.maxthreads))
+      {
+        if(stats.maxthreads > mMaxThreads)
+        {
+          return -1;
+        }
+      }
+      return 0;
+    }
+  };
+}
+
+#endif /* __HEURISTICSCALING_H__ */
@@ -0,0 +1,415 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: PoolMetrics.h 1 2021-04-04 10:48:20Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __POOLMETRICS_H__
+#  define __POOLMETRICS_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <typeinfo>
+#include <algorithm>
+#include <cxxabi.h>
+#include <abstract/Runnable.h>
+#include <TSLog.h>
+
+#ifndef ITC_TASK_TIMING
+#  define ITC_TASK_TIMING 1
+#endif
+
+namespace itc
+{
+  /**
+   * @brief a sample of the thread pool state. The pool fills it under its
+   * lock, so the counts are consistent with each other.
+   **/
+  struct tpstats
+  {
+    size_t   tqdp;       // tasks queue depth
+    size_t   tc;         // threads
+    size_t   tpc;        // passive (idle) threads
+    size_t   tac;        // active (busy) threads
+    size_t   maxthreads;
+    float    overcommit;
+    uint64_t enqueued;   // tasks enqueued since the start
+    uint64_t completed;  // tasks completed since the start
+    uint64_t timestamp;  // CLOCK_MONOTONIC nanoseconds of the sample
+  };
+
+  /**
+   * @brief the clock of the task timing. The ticks are the TSC on x86 (a
+   * few nanoseconds to read, constant rate on the current CPUs), the
+   * CLOCK_MONOTONIC nanoseconds elsewhere.
+   **/
+  struct TaskClock
+  {
+    static const uint64_t nanoseconds()
+    {
+      ::timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+    }
+
+    static const uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      return __builtin_ia32_rdtsc();
+#else
+      return nanoseconds();
+#endif
+    }
+  };
+
+  /**
+   * @brief a copy of the LatencyHistogram. HDR-style log-linear buckets:
+   * the values below 8 ticks have a bucket each, above that every power of
+   * two is split into 8 buckets, so a bucket is at most 12.5% wide. The
+   * buckets are in ticks, the scale converts them to nanoseconds, the sum
+   * and the max are in nanoseconds already.
+   **/
+  struct histogram
+  {
+    static constexpr size_t SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    double   scale; // nanoseconds per tick
+    uint64_t buckets[BUCKETS];
+
+    static const size_t index(const uint64_t ticks)
+    {
+      if(ticks < SUB_BUCKETS)
+      {
+        return size_t(ticks);
+      }
+      const size_t magnitude = size_t(63 - __builtin_clzll(ticks));
+      return ((magnitude - SUB_BITS + 1) << SUB_BITS) | size_t((ticks >> (magnitude - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    /**
+     * @return the lowest value of the bucket in ticks.
+     **/
+    static const uint64_t lowest(const size_t bucket)
+    {
+      if(bucket < SUB_BUCKETS)
+      {
+        return bucket;
+      }
+      const size_t magnitude = (bucket >> SUB_BITS) + SUB_BITS - 1;
+      return (uint64_t(SUB_BUCKETS) | (bucket & (SUB_BUCKETS - 1))) << (magnitude - SUB_BITS);
+    }
+
+    /**
+     * @return the highest value of the bucket in nanoseconds, e.g. for the
+     * "le" label of the Prometheus histogram.
+     **/
+    const uint64_t upperBound(const size_t bucket) const
+    {
+      if(bucket + 1 >= BUCKETS)
+      {
+        return max;
+      }
+      return uint64_t(double(lowest(bucket + 1) - 1) * scale);
+    }
+
+    /**
+     * @return upper bound of the bucket of the q-th quantile (0..1) in
+     * nanoseconds, 0 if there are no values.
+     **/
+    const uint64_t percentile(const double q) const
+    {
+      const uint64_t rank = uint64_t(q * double(count));
+      uint64_t seen = 0;
+      for(size_t i = 0; i < BUCKETS; ++i)
+      {
+        seen += buckets[i];
+        if((seen > rank)||((seen == count)&&(seen > 0)))
+        {
+          return std::min(upperBound(i), max);
+        }
+      }
+      return 0;
+    }
+
+    const double mean() const
+    {
+      return (count == 0) ? 0 : double(sum) / double(count);
+    }
+  };
+
+  /**
+   * @brief lock-free histogram of the durations in ticks. The threads
+   * record to one of the stripes (by the thread), so the workers don't
+   * bounce the same cache lines. The copy is not a consistent cut, but
+   * every counter in it is exact.
+   **/
+  class LatencyHistogram
+  {
+   private:
+    static constexpr size_t STRIPES = 8;
+
+    struct Stripe
+    {
+      std::atomic<uint64_t> buckets[histogram::BUCKETS];
+      std::atomic<uint64_t> sum;
+      std::atomic<uint64_t> max;
+      char                  pad[64];
+    };
+
+    Stripe mStripes[STRIPES];
+
+    static const size_t stripe()
+    {
+      static std::atomic<size_t> next{0};
+      static thread_local const size_t slot = next.fetch_add(1) % STRIPES;
+      return slot;
+    }
+
+   public:
+    explicit LatencyHistogram()
+    {
+      for(auto& stripe : mStripes)
+      {
+        for(auto& bucket : stripe.buckets)
+        {
+          bucket.store(0, std::memory_order_relaxed);
+        }
+        stripe.sum.store(0, std::memory_order_relaxed);
+        stripe.max.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    LatencyHistogram(const LatencyHistogram&)=delete;
+    LatencyHistogram(LatencyHistogram&)=delete;
+
+    void record(const uint64_t ticks)
+    {
+      Stripe& own = mStripes[stripe()];
+      own.buckets[histogram::index(ticks)].fetch_add(1, std::memory_order_relaxed);
+      own.sum.fetch_add(ticks, std::memory_order_relaxed);
+      uint64_t max = own.max.load(std::memory_order_relaxed);
+      while((ticks > max)&&(!own.max.compare_exchange_weak(max, ticks, std::memory_order_relaxed)));
+    }
+
+    /**
+     * @param scale - nanoseconds per tick
+     **/
+    void copy(histogram& out, const double scale) const
+    {
+      uint64_t sum = 0;
+      uint64_t max = 0;
+
+      out.count = 0;
+      out.scale = scale;
+      for(size_t i = 0; i < histogram::BUCKETS; ++i)
+      {
+        out.buckets[i] = 0;
+      }
+      for(const auto& stripe : mStripes)
+      {
+        for(size_t i = 0; i < histogram::BUCKETS; ++i)
+        {
+          const uint64_t value = stripe.buckets[i].load(std::memory_order_relaxed);
+          out.buckets[i] += value;
+          out.count += value;
+        }
+        sum += stripe.sum.load(std::memory_order_relaxed);
+        max = std::max(max, stripe.max.load(std::memory_order_relaxed));
+      }
+      out.sum = uint64_t(double(sum) * scale);
+      out.max = uint64_t(double(max) * scale);
+    }
+  };
+
+  /**
+   * @brief the counters and histograms of a ThreadPool. They are shared
+   * with the pool's running tasks, which may outlive the pool.
+   *
+   * The tasks are timestamped at enqueue, start and finish (three reads of
+   * the TaskClock per task). Build with ITC_TASK_TIMING=0 to compile the
+   * timing out, then only the completed tasks are counted.
+   *
+   * The slow tasks (see setSlowTaskLog()) are logged with the type of the
+   * Runnable, every n-th of them to keep the log readable.
+   **/
+  class PoolMetrics
+  {
+   private:
+    std::atomic<uint64_t> mCompleted;
+    const uint64_t        mStartTicks;
+    const uint64_t        mStartNanoseconds;
+    std::atomic<uint64_t> mCalibrated; // bits of the settled scale, 0 until then
+    std::atomic<uint64_t> mSlowNanoseconds;
+    std::atomic<uint64_t> mSlowSample;
+    std::atomic<uint64_t> mSlowSeen;
+    LatencyHistogram      mWait;
+    LatencyHistogram      mExec;
+
+    static const std::string typeName(const abstract::IRunnable& task)
+    {
+      const char* mangled = typeid(task).name();
+      int status = 0;
+      char* demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+      const std::string result(((status == 0)&&(demangled != nullptr)) ? demangled : mangled);
+      free(demangled);
+      return result;
+    }
+
+    /**
+     * @brief the scale of the slow-task check. It is recalibrated on each
+     * call until CALIBRATION_NS have passed since the start, then frozen,
+     * so the steady state costs one atomic load.
+     **/
+    const double calibrated()
+    {
+      uint64_t bits = mCalibrated.load(std::memory_order_relaxed);
+      double result = 0;
+      if(bits != 0)
+      {
+        memcpy(&result, &bits, sizeof(result));
+        return result;
+      }
+      result = scale();
+      if(TaskClock::nanoseconds() - mStartNanoseconds >= CALIBRATION_NS)
+      {
+        memcpy(&bits, &result, sizeof(bits));
+        mCalibrated.store(bits, std::memory_order_relaxed);
+      }
+      return result;
+    }
+
+    void slow(const abstract::IRunnable& task, const uint64_t waited, const uint64_t ran, const double ns)
+    {
+      if((mSlowSeen.fetch_add(1, std::memory_order_relaxed) % mSlowSample.load(std::memory_order_relaxed)) == 0)
+      {
+        ::itc::getLog()->info(
+          __FILE__, __LINE__,
+          "ThreadPool slow task %s: waited %ju ns, ran %ju ns",
+          typeName(task).c_str(), uint64_t(double(waited) * ns), uint64_t(double(ran) * ns)
+        );
+      }
+    }
+
+   public:
+    static const uint64_t CALIBRATION_NS = 100000000;
+
+    explicit PoolMetrics()
+    : mCompleted{0}, mStartTicks(TaskClock::ticks()), mStartNanoseconds(TaskClock::nanoseconds()),
+      mCalibrated{0}, mSlowNanoseconds{0}, mSlowSample{1}, mSlowSeen{0}, mWait(), mExec(){}
+
+    PoolMetrics(const PoolMetrics&)=delete;
+    PoolMetrics(PoolMetrics&)=delete;
+
+    /**
+     * @return the timestamp of the task in ticks, 0 if the timing is
+     * compiled out.
+     **/
+    static const uint64_t stamp()
+    {
+#if ITC_TASK_TIMING
+      return TaskClock::ticks();
+#else
+      return 0;
+#endif
+    }
+
+    /**
+     * @return nanoseconds per tick, calibrated against CLOCK_MONOTONIC over
+     * the lifetime of the metrics.
+     **/
+    const double scale() const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      const uint64_t ticks = TaskClock::ticks() - mStartTicks;
+      const uint64_t ns = TaskClock::nanoseconds() - mStartNanoseconds;
+      return (ticks == 0) ? 1.0 : double(ns) / double(ticks);
+#else
+      return 1.0;
+#endif
+    }
+
+    /**
+     * @brief logs the tasks which run threshold_ns or longer, every n-th
+     * of them. threshold_ns == 0 turns the log off. The threshold is kept
+     * in nanoseconds and compared to the task's run time converted at the
+     * time it completes, when the TSC calibration has had time to settle.
+     **/
+    void setSlowTaskLog(const uint64_t threshold_ns, const uint64_t every = 1)
+    {
+      mSlowSample.store(std::max(uint64_t(1), every), std::memory_order_relaxed);
+      mSlowNanoseconds.store(threshold_ns, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief the task enqueued and started at the given stamps has been
+     * executed (or has thrown).
+     **/
+    void completed(const uint64_t enqueued, const uint64_t started, const abstract::IRunnable& task)
+    {
+#if ITC_TASK_TIMING
+      const uint64_t finished = stamp();
+      const uint64_t waited = (started > enqueued) ? started - enqueued : 0;
+      const uint64_t ran = (finished > started) ? finished - started : 0;
+      const uint64_t threshold = mSlowNanoseconds.load(std::memory_order_relaxed);
+
+      mWait.record(waited);
+      mExec.record(ran);
+      if(threshold != 0)
+      {
+        const double ns = calibrated();
+        if(double(ran) * ns >= double(threshold))
+        {
+          slow(task, waited, ran, ns);
+        }
+      }
+#endif
+      mCompleted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const uint64_t getCompleted() const
+    {
+      return mCompleted.load(std::memory_order_relaxed);
+    }
+
+    void getWaitHistogram(histogram& out) const
+    {
+      mWait.copy(out, scale());
+    }
+
+    void getExecHistogram(histogram& out) const
+    {
+      mExec.copy(out, scale());
+    }
+  };
+
+  /**
+   * @brief the state of a ThreadPoolManager's pool, published once per
+   * sample. The histograms are cumulative since the pool is created.
+   **/
+  struct tpsnapshot
+  {
+    tpstats   pool;
+    double    arrival;    // tasks enqueued per second within the last sample
+    double    throughput; // tasks completed per second within the last sample
+    histogram wait;       // queue wait time, nanoseconds
+    histogram exec;       // execution time, nanoseconds
+  };
+}
+
+#endif /* __POOLMETRICS_H__ */
@@ -0,0 +1,153 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: PriorityTaskQueue.h 1 2021-03-05 18:21:40Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __PRIORITYTASKQUEUE_H__
+#  define __PRIORITYTASKQUEUE_H__
+
+#include <queue>
+#include <atomic>
+#include <utility>
+#include <stdexcept>
+
+namespace itc
+{
+  enum TaskPriority
+  {
+    HIGH, NORMAL, LOW, PRIORITY_LEVELS
+  };
+
+  /**
+   * @brief multi-level FIFO queue. The tasks are taken from the highest
+   * priority level, which is not empty. To protect the lower levels from
+   * starvation, a non-empty level which was bypassed mStarvationLimit times
+   * in a row is served next regardless of the higher levels.
+   *
+   * This class is not thread safe, the owner must synchronize access. The
+   * depth counters are atomic and may be read without the owner's lock.
+   **/
+  template <typename T> class PriorityTaskQueue
+  {
+   private:
+    std::queue<T>       mLevels[PRIORITY_LEVELS];
+    size_t              mBypassed[PRIORITY_LEVELS];
+    std::atomic<size_t> mDepth[PRIORITY_LEVELS];
+    size_t              mStarvationLimit;
+
+    const size_t selectLevel() const
+    {
+      for(size_t level = PRIORITY_LEVELS - 1; level > 0; --level)
+      {
+        if((!mLevels[level].empty())&&(mBypassed[level] >= mStarvationLimit))
+        {
+          return level;
+        }
+      }
+
+      for(size_t level = 0; level < PRIORITY_LEVELS; ++level)
+      {
+        if(!mLevels[level].empty())
+        {
+          return level;
+        }
+      }
+      throw std::logic_error("PriorityTaskQueue<T>::selectLevel() - the queue is empty");
+    }
+
+   public:
+    explicit PriorityTaskQueue(const size_t starvation_limit = 32)
+    : mStarvationLimit(starvation_limit)
+    {
+      for(size_t level = 0; level < PRIORITY_LEVELS; ++level)
+      {
+        mBypassed[level] = 0;
+        mDepth[level].store(0);
+      }
+    }
+
+    PriorityTaskQueue(const PriorityTaskQueue&) = delete;
+    PriorityTaskQueue(PriorityTaskQueue&) = delete;
+
+    void push(const T& ref, const TaskPriority priority = NORMAL)
+    {
+      mLevels[priority].push(ref);
+      ++mDepth[priority];
+    }
+
+    void push(T&& ref, const TaskPriority priority = NORMAL)
+    {
+      mLevels[priority].push(std::move(ref));
+      ++mDepth[priority];
+    }
+
+    /**
+     * @brief removes and returns the next task. The queue must not be empty.
+     **/
+    T take()
+    {
+      const size_t level = selectLevel();
+
+      for(size_t lower = level + 1; lower < PRIORITY_LEVELS; ++lower)
+      {
+        if(!mLevels[lower].empty())
+        {
+          ++mBypassed[lower];
+        }
+      }
+      mBypassed[level] = 0;
+
+      T result(std::move(mLevels[level].front()));
+      mLevels[level].pop();
+      --mDepth[level];
+      return result;
+    }
+
+    const bool empty() const
+    {
+      for(size_t level = 0; level < PRIORITY_LEVELS; ++level)
+      {
+        if(!mLevels[level].empty())
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    const size_t size() const
+    {
+      size_t result = 0;
+      for(size_t level = 0; level < PRIORITY_LEVELS; ++level)
+      {
+        result += mDepth[level].load();
+      }
+      return result;
+    }
+
+    const size_t size(const TaskPriority priority) const
+    {
+      return mDepth[priority].load();
+    }
+
+    void clear()
+    {
+      for(size_t level = 0; level < PRIORITY_LEVELS; ++level)
+      {
+        std::queue<T> empty;
+        std::swap(mLevels[level], empty);
+        mBypassed[level] = 0;
+        mDepth[level].store(0);
+      }
+    }
+  };
+}
+
+#endif /* __PRIORITYTASKQUEUE_H__ */
@@ -0,0 +1,287 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: QueueAdapter.h 1 2021-03-24 17:52:40Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __QUEUEADAPTER_H__
+#  define __QUEUEADAPTER_H__
+
+#include <sched.h>
+#include <cerrno>
+#include <atomic>
+#include <utility>
+#include <system_error>
+#include <Val2Type.h>
+#include <abstract/QueueInterface.h>
+#include <tsbqueue.h>
+#include <tsqueue.h>
+#include <cfifo.h>
+#include <lfqueue.h>
+
+namespace itc
+{
+  /**
+   * @brief uniform access to the queue backends for QueueAdapter. The
+   * primary template serves the non-blocking queues with push() and
+   * try_pop() (tsqueue, lfqueue), which are never full.
+   **/
+  template <typename Queue> struct QueueOps
+  {
+    typedef typename Queue::value_type value_type;
+    static constexpr bool blocking = false;
+
+    static const bool trySend(Queue& queue, const value_type& ref)
+    {
+      queue.push(ref);
+      return true;
+    }
+
+    static void send(Queue& queue, const value_type& ref)
+    {
+      queue.push(ref);
+    }
+
+    static const bool tryRecv(Queue& queue, value_type& ref)
+    {
+      return queue.try_pop(ref);
+    }
+
+    static void recv(Queue& queue, value_type& ref)
+    {
+      throw std::logic_error("QueueOps<Queue>::recv() - the queue can't block");
+    }
+
+    static const size_t depth(Queue& queue)
+    {
+      return queue.size();
+    }
+
+    static void shutdown(Queue& queue)
+    {
+    }
+  };
+
+  template <typename T, typename MutexType> struct QueueOps<tsbqueue<T,MutexType>>
+  {
+    typedef tsbqueue<T,MutexType> Queue;
+    typedef T value_type;
+    static constexpr bool blocking = true;
+
+    // tsbqueue takes single messages as const DataType&& and copies them
+    // into its ring, so the cast below only selects that overload, the
+    // message is copied either way.
+    static const bool trySend(Queue& queue, const value_type& ref)
+    {
+      return queue.try_send(static_cast<const value_type&&>(ref));
+    }
+
+    static void send(Queue& queue, const value_type& ref)
+    {
+      queue.send(static_cast<const value_type&&>(ref));
+    }
+
+    static const bool tryRecv(Queue& queue, value_type& ref)
+    {
+      return queue.try_recv(ref);
+    }
+
+    static void recv(Queue& queue, value_type& ref)
+    {
+      queue.recv(ref);
+    }
+
+    static const size_t depth(Queue& queue)
+    {
+      return queue.size();
+    }
+
+    static void shutdown(Queue& queue)
+    {
+      queue.shutdown();
+    }
+  };
+
+  template <typename T, CFifoPolicy policy> struct QueueOps<cfifo<T,policy>>
+  {
+    typedef cfifo<T,policy> Queue;
+    typedef T value_type;
+    static constexpr bool blocking = true;
+
+    static const bool trySend(Queue& queue, const value_type& ref)
+    {
+      return queue.try_send(ref);
+    }
+
+    static void send(Queue& queue, const value_type& ref)
+    {
+      queue.send(ref);
+    }
+
+    static const bool tryRecv(Queue& queue, value_type& ref)
+    {
+      return queue.try_recv(ref);
+    }
+
+    static void recv(Queue& queue, value_type& ref)
+    {
+      queue.recv(ref);
+    }
+
+    static const size_t depth(Queue& queue)
+    {
+      return queue.size();
+    }
+
+    static void shutdown(Queue& queue)
+    {
+      queue.shutdown();
+    }
+  };
+
+  /**
+   * @brief implements QueueInterface on top of any of tsbqueue, cfifo,
+   * tsqueue and lfqueue, so the backend can be switched without touching
+   * the call sites.
+   *
+   * With ASYNC policy send() and recv() never block and return false if
+   * the queue is full (busy) or empty. With SYNC policy they block until
+   * done and return false only if the queue is destroyed. The backends
+   * without blocking operations (tsqueue, lfqueue) are polled with
+   * sched_yield() in SYNC recv().
+   *
+   * Usage:
+   *    QueueAdapter<cfifo<Msg>, SYNC> queue(1024);
+   *    QueueInterface<Msg>& iface=queue;
+   **/
+  template <typename Queue, QueueBlockPolicy policy = SYNC> class QueueAdapter
+  : public QueueInterface<typename Queue::value_type>
+  {
+   public:
+    typedef typename Queue::value_type value_type;
+
+   private:
+    typedef QueueOps<Queue> Ops;
+
+    Queue             mQueue;
+    std::atomic<bool> mValid;
+
+    static const bool isRemoved(const std::system_error& e)
+    {
+      return e.code().value() == EIDRM;
+    }
+
+    const bool send(const value_type& ref, ::itc::utils::Int2Type<ASYNC> fictive)
+    {
+      return Ops::trySend(mQueue, ref);
+    }
+
+    const bool send(const value_type& ref, ::itc::utils::Int2Type<SYNC> fictive)
+    {
+      Ops::send(mQueue, ref);
+      return true;
+    }
+
+    const bool recv(value_type& ref, ::itc::utils::Int2Type<ASYNC> fictive)
+    {
+      return Ops::tryRecv(mQueue, ref);
+    }
+
+    const bool recv(value_type& ref, ::itc::utils::Int2Type<SYNC> fictive)
+    {
+      return recv(ref, ::itc::utils::Bool2Type<Ops::blocking>{});
+    }
+
+    const bool recv(value_type& ref, ::itc::utils::Bool2Type<true> blocking)
+    {
+      Ops::recv(mQueue, ref);
+      return true;
+    }
+
+    const bool recv(value_type& ref, ::itc::utils::Bool2Type<false> blocking)
+    {
+      while(mValid.load())
+      {
+        if(Ops::tryRecv(mQueue, ref))
+          return true;
+        sched_yield();
+      }
+      return false;
+    }
+
+   public:
+    template <typename... Args> explicit QueueAdapter(Args&&... args)
+    : QueueInterface<value_type>(), mQueue(std::forward<Args>(args)...), mValid{true}
+    {
+    }
+
+    QueueAdapter(const QueueAdapter&)=delete;
+    QueueAdapter(QueueAdapter&)=delete;
+
+    ~QueueAdapter()
+    {
+      destroy();
+    }
+
+    bool send(const value_type& ref) override
+    {
+      if(!mValid.load())
+        return false;
+      try
+      {
+        return send(ref, ::itc::utils::Int2Type<policy>{});
+      }catch(const std::system_error& e)
+      {
+        if(isRemoved(e))
+          return false;
+        throw;
+      }
+    }
+
+    bool recv(value_type& ref) override
+    {
+      if(!mValid.load())
+        return false;
+      try
+      {
+        return recv(ref, ::itc::utils::Int2Type<policy>{});
+      }catch(const std::system_error& e)
+      {
+        if(isRemoved(e))
+          return false;
+        throw;
+      }
+    }
+
+    size_t depth() override
+    {
+      return Ops::depth(mQueue);
+    }
+
+    /**
+     * @brief releases all blocked senders and receivers, they and all
+     * following calls return false.
+     **/
+    void destroy() override
+    {
+      mValid.store(false);
+      Ops::shutdown(mQueue);
+    }
+
+    /**
+     * @return the backend for the operations the interface doesn't cover.
+     **/
+    Queue& getQueue()
+    {
+      return mQueue;
+    }
+  };
+}
+
+#endif /* __QUEUEADAPTER_H__ */
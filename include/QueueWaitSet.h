@@ -0,0 +1,182 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: QueueWaitSet.h 1 2021-03-20 11:37:08Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __QUEUEWAITSET_H__
+#  define __QUEUEWAITSET_H__
+
+#include <atomic>
+#include <ctime>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <EventCount.h>
+
+namespace itc
+{
+  /**
+   * @brief blocks until any of the attached tsbqueue instances has data and
+   * tells which one is ready, so one thread can serve many queues without
+   * polling them. The queues notify the wait-set's EventCount on send, so
+   * the waiting costs nothing while all queues are empty.
+   *
+   * Usage:
+   *    QueueWaitSet ws;
+   *    const size_t a=ws.add(qa), b=ws.add(qb);
+   *    for(;;)
+   *    {
+   *      const size_t ready=ws.wait();
+   *      if(ready == a && qa.try_recv(msg)) ...
+   *    }
+   *
+   * Queues may be added and removed while other threads wait. wait() may
+   * be called from several threads. The ready queue may be drained by another consumer
+   * before the caller gets to it, so use try_recv() on the ready queue.
+   * A queue may belong to one wait-set at a time and must outlive it or
+   * be removed with remove().
+   **/
+  class QueueWaitSet
+  {
+   private:
+    struct Entry
+    {
+      std::function<bool()> ready;
+      std::function<void()> detach;
+    };
+
+    mutable std::mutex  mMutex;
+    std::vector<Entry>  mQueues;
+    std::atomic<size_t> mNext;
+    EventCount          mEvent;
+
+    /**
+     * @brief scans the queues round-robin, so a busy queue does not starve
+     * the others.
+     **/
+    const bool findReady(size_t& index)
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      const size_t count=mQueues.size();
+      const size_t start=mNext.fetch_add(1);
+
+      for(size_t i=0;i<count;++i)
+      {
+        const size_t pos=(start+i)%count;
+        if(mQueues[pos].ready && mQueues[pos].ready())
+        {
+          index=pos;
+          return true;
+        }
+      }
+      return false;
+    }
+
+   public:
+    explicit QueueWaitSet() : mMutex(), mQueues(), mNext{0}, mEvent(){}
+    QueueWaitSet(const QueueWaitSet&)=delete;
+    QueueWaitSet(QueueWaitSet&)=delete;
+
+    ~QueueWaitSet()
+    {
+      for(auto& entry : mQueues)
+      {
+        if(entry.detach) entry.detach();
+      }
+    }
+
+    /**
+     * @return index of the queue in this wait-set, wait() returns it when
+     * the queue has data.
+     **/
+    template <typename Queue> const size_t add(Queue& queue)
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      queue.attach(&mEvent);
+      mQueues.push_back({[&queue](){ return !queue.empty(); },[&queue](){ queue.detach(); }});
+      return mQueues.size()-1;
+    }
+
+    /**
+     * @brief detaches the queue. The index stays reserved and is never
+     * returned by wait(). Safe against concurrent wait(), the entry is
+     * not erased while a scan is calling it.
+     **/
+    void remove(const size_t index)
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      if(index < mQueues.size())
+      {
+        if(mQueues[index].detach) mQueues[index].detach();
+        mQueues[index]=Entry();
+      }
+    }
+
+    /**
+     * @brief blocks until one of the queues has data.
+     * @return index of the ready queue.
+     **/
+    const size_t wait()
+    {
+      size_t index=0;
+      while(!findReady(index))
+      {
+        const uint32_t key=mEvent.prepareWait();
+        if(findReady(index))
+        {
+          mEvent.cancelWait();
+          break;
+        }
+        mEvent.wait(key);
+      }
+      return index;
+    }
+
+    /**
+     * @brief same as wait(), but gives up at the absolute CLOCK_REALTIME
+     * timeout.
+     * @return false on timeout.
+     **/
+    const bool wait(size_t& index, const ::timespec& timeout)
+    {
+      while(!findReady(index))
+      {
+        const uint32_t key=mEvent.prepareWait();
+        if(findReady(index))
+        {
+          mEvent.cancelWait();
+          break;
+        }
+        if(!mEvent.wait(key,timeout))
+        {
+          return findReady(index);
+        }
+      }
+      return true;
+    }
+
+    /**
+     * @brief non-blocking check.
+     * @return false if all queues are empty.
+     **/
+    const bool poll(size_t& index)
+    {
+      return findReady(index);
+    }
+
+    const size_t size() const
+    {
+      std::lock_guard<std::mutex> sync(mMutex);
+      return mQueues.size();
+    }
+  };
+}
+
+#endif /* __QUEUEWAITSET_H__ */
@@ -16,22 +16,30 @@
 
 
 #  include <stdint.h>
+#  include <time.h>
 #  include <memory>
-#  include <map>
 #  include <string>
-#  include <list>
+#  include <vector>
 #  include <abstract/Runnable.h>
+#  include <abstract/ITimerQueue.h>
 #  include <InterfaceCheck.h>
 #  include <cmath>
 #  include <Date.h>
 #  include <Singleton.h>
 #  include <sched.h>
 #  include <ThreadPool.h>
+#  include <TimerMap.h>
+#  include <TimerWheel.h>
 #  include <DateFormatter.h>
-#  include <sys/Nanosleep.h>
+#  include <sys/prctl.h>
 #  include <limits>
 #  include <mutex>
+#  include <condition_variable>
+#  include <algorithm>
+#  include <chrono>
 #  include <atomic>
+#  include <thread>
+#  include <stdexcept>
 
 typedef itc::utils::Date Date;
 typedef itc::utils::Time Time;
@@ -45,41 +53,364 @@ namespace itc
    * @brief implements scheduling of tasks execution at specific timepoint.
    * With this class it is possible to schedule a task to be executed within 
    * some miliseconds after call to RScheduler::add() method.
-   * The execution of a task is scheduled to happen at the specific time,
-   * however it may be delayed by 100 microseconds or a little longer. The 
-   * delay over 100 microseconds depends on a granularity of a system 
-   * timers.
+   * The execution of a task is scheduled to happen at the specific time.
+   * The scheduler thread sleeps on a condition variable until the earliest
+   * deadline (add() wakes it up, if the new deadline is earlier), so the
+   * idle scheduler costs nothing and the delay depends only on the wake up
+   * latency of the system.
+   *
+   * The timers are kept either in std::map (TIMER_MAP, exact deadlines,
+   * O(log n) insert) or in the hierarchical timing wheel (TIMER_WHEEL,
+   * O(1) insert, deadlines rounded up to the wheel tick), which suits
+   * hundreds of thousands of pending timeouts.
+   *
+   * add() returns a TimerHandle, the pending timer is cancelled or moved
+   * with cancel() and reschedule() in O(1) (TIMER_WHEEL) or O(log n)
+   * (TIMER_MAP) without waiting for it to expire. addPeriodic() schedules
+   * a job repeated at FIXED_RATE (the cadence of the first deadline, the
+   * missed periods are skipped) or with FIXED_DELAY between the end of a
+   * run and the start of the next one. A periodic job never runs
+   * concurrently with itself, it is re-armed when its run is finished.
+   *
+   * With shards > 1 the timers are split over several timer structures,
+   * each under its own lock, and the threads add to the shard of their CPU.
+   * The adders take the scheduler's mMutex only to wake it up for an
+   * earlier deadline, the scheduler thread expires all the shards and
+   * dispatches their timers to the pool as one batch.
    **/
   class RScheduler : public abstract::IRunnable
   {
+   public:
+    enum TimerBackend
+    {
+      TIMER_MAP, TIMER_WHEEL
+    };
+
+    enum Repeat
+    {
+      ONCE, FIXED_RATE, FIXED_DELAY
+    };
+
    private:
     typedef ::std::shared_ptr<abstract::IRunnable> storable;
-    typedef ::std::list<storable> storable_container;
-    typedef typename storable_container::iterator scIterator;
-    typedef ::std::map<Date, storable_container> map_type;
-    typedef typename map_type::iterator mapIterator;
+    typedef ::std::vector<storable> storable_container;
+
+    /**
+     * @brief the scheduled task and its state, guarded by its shard's lock. The
+     * periodic timer is dispatched itself, to re-arm after the task's run.
+     * The scheduler outlives the running timers, its thread pool is
+     * destroyed first.
+     **/
+    struct Timer : public abstract::IRunnable, public std::enable_shared_from_this<Timer>
+    {
+      RScheduler* scheduler;
+      size_t      shard;
+      storable    task;
+      uint64_t    id; // in the mSchedule, 0 if not pending
+      uint64_t    deadline;
+      uint64_t    period;
+      Repeat      repeat;
+      bool        cancelled;
+
+      explicit Timer(RScheduler* owner, const size_t index, const storable& ref,
+                     const uint64_t when, const uint64_t interval, const Repeat mode)
+      : scheduler(owner), shard(index), task(ref), id(0), deadline(when), period(interval),
+        repeat(mode), cancelled(false){}
+
+      /**
+       * @brief runs the task and re-arms a periodic timer even if the task
+       * has thrown, one failed run must not stop the schedule.
+       **/
+      void execute()
+      {
+        try
+        {
+          task->execute();
+        }catch(const std::exception& e)
+        {
+          itc::getLog()->error(
+            __FILE__, __LINE__,
+            "RScheduler::Timer::execute() - the Runnable has thrown an exception: %s", e.what()
+          );
+        }catch(...)
+        {
+          itc::getLog()->error(
+            __FILE__, __LINE__,
+            "RScheduler::Timer::execute() - the Runnable has thrown an unknown exception"
+          );
+        }
+        scheduler->rearm(this->shared_from_this());
+      }
+
+      void onCancel()
+      {
+        task->onCancel();
+      }
+
+      void shutdown()
+      {
+        task->shutdown();
+      }
+    };
+
+    typedef ::std::shared_ptr<Timer> timer_pointer;
+    typedef ::std::vector<timer_pointer> timer_container;
+    typedef typename timer_container::iterator tcIterator;
+    typedef abstract::ITimerQueue<timer_pointer> timer_queue;
     typedef ::itc::ThreadPool ThreadPoolType;
     typedef ::std::shared_ptr<ThreadPoolType> ThreadPoolPointer;
 
+    /**
+     * @brief a timer structure with its own lock. The threads add to the
+     * shard of the CPU they run on (or of the thread itself, when there are
+     * fewer CPUs than shards), so they don't contend with each other
+     * nor with the scheduler thread, which expires the shards one by one.
+     * The nextWake mirrors the shard's earliest deadline for the scheduler
+     * thread and the adders to read without the lock.
+     **/
+    struct Shard
+    {
+      std::mutex                    mutex;
+      std::unique_ptr<timer_queue>  schedule;
+      std::atomic<uint64_t>         nextWake;
+
+      explicit Shard(timer_queue* queue)
+      : mutex(), schedule(queue), nextWake(std::numeric_limits<uint64_t>::max()){}
+    };
+
+    typedef ::std::unique_ptr<Shard> ShardPointer;
+
 
     std::mutex mMutex;
+    std::condition_variable mWakeup;
     std::atomic<bool> mDoRun;
     std::atomic<bool> mMayAdd;
-    Time mNextWake;
-    map_type mSchedule;
-    size_t mShakePoolsTO;
+    std::atomic<uint64_t> mSleepUntil; // deadline the scheduler thread sleeps for, 0 if awake
+    bool mWoken;
+    uint64_t mShakeAt;
+    std::vector<ShardPointer> mShards;
+    size_t mCPUs;
+    timer_container mExpired;
+    storable_container mDispatch; // used by the scheduler thread only
+    uint64_t mShakePoolsTO; // nanoseconds from a dispatch to the pool's shakePools()
     ThreadPoolPointer mThreadPool;
 
+    /**
+     * @return CLOCK_MONOTONIC time in nanoseconds (vDSO, no system call),
+     * the deadlines are kept in the same units. The monotonic clock does
+     * not jump when the wall clock is set or stepped by NTP.
+     **/
+    static const uint64_t now()
+    {
+      ::timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+    }
+
+    static const uint64_t milliseconds(const uint32_t ms)
+    {
+      return uint64_t(ms) * 1000000;
+    }
+
+    static timer_queue* makeTimerQueue(const TimerBackend backend, const uint32_t tick_us)
+    {
+      if(backend == TIMER_WHEEL)
+      {
+        return new TimerWheel<timer_pointer>(uint64_t(tick_us) * 1000, now());
+      }
+      return new TimerMap<timer_pointer>();
+    }
+
+    /**
+     * @return the shard of the CPU the calling thread runs on. With fewer
+     * CPUs than shards (or without sched_getcpu()) the threads are given
+     * the shards round-robin once, so they still spread over all of them.
+     **/
+    const size_t getShard() const
+    {
+      if(mShards.size() == 1)
+      {
+        return 0;
+      }
+      if(mCPUs >= mShards.size())
+      {
+        const int cpu = sched_getcpu();
+        if(cpu >= 0)
+        {
+          return size_t(cpu) % mShards.size();
+        }
+      }
+      static std::atomic<size_t> next{0};
+      static thread_local const size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+      return slot % mShards.size();
+    }
+
+    /**
+     * @return the earliest deadline of all shards.
+     **/
+    const uint64_t getNextWake() const
+    {
+      uint64_t result = std::numeric_limits<uint64_t>::max();
+      for(const auto& shard : mShards)
+      {
+        result = std::min(result, shard->nextWake.load());
+      }
+      return result;
+    }
+
+    /**
+     * @brief publishes the shard's earliest deadline, called under the
+     * shard's lock.
+     * @return the deadline.
+     **/
+    static const uint64_t resetNextWake(Shard& shard)
+    {
+      uint64_t deadline;
+      if(!shard.schedule->getNextDeadline(deadline))
+      {
+        deadline = std::numeric_limits<uint64_t>::max();
+      }
+      shard.nextWake.store(deadline);
+      return deadline;
+    }
+
+    /**
+     * @brief puts the timer to its shard's schedule at its deadline. Called
+     * under the shard's lock.
+     * @return the shard's earliest deadline.
+     **/
+    const uint64_t arm(Shard& shard, const timer_pointer& timer)
+    {
+      timer->id = shard.schedule->insert(timer->deadline, timer);
+      return resetNextWake(shard);
+    }
+
+    /**
+     * @brief wakes up the scheduler thread if it sleeps for a later
+     * deadline. Called out of the shard's lock, after the deadline is
+     * published in the shard's nextWake, the scheduler thread re-reads the
+     * shards after it publishes mSleepUntil, so either of them sees the
+     * other's update.
+     **/
+    void wakeup(const uint64_t deadline)
+    {
+      if(deadline < mSleepUntil.load())
+      {
+        {
+          std::lock_guard<std::mutex> dosync(mMutex);
+          mWoken = true;
+        }
+        mWakeup.notify_one();
+      }
+    }
+
+    /**
+     * @brief schedules the next run of the periodic timer, called when the
+     * run is finished.
+     **/
+    void rearm(const timer_pointer& timer)
+    {
+      Shard& shard = *mShards[timer->shard];
+      uint64_t deadline;
+      {
+        std::lock_guard<std::mutex> dosync(shard.mutex);
+
+        if(timer->cancelled || (!mDoRun) || (!mMayAdd))
+        {
+          return;
+        }
+
+        const uint64_t current = now();
+
+        if(timer->repeat == FIXED_RATE)
+        {
+          timer->deadline += timer->period;
+          if(timer->deadline < current)
+          {
+            timer->deadline += ((current - timer->deadline + timer->period - 1) / timer->period) * timer->period;
+          }
+        }else
+        {
+          timer->deadline = current + timer->period;
+        }
+        deadline = arm(shard, timer);
+      }
+      wakeup(deadline);
+    }
+
+    /**
+     * @brief moves the expired timers of the shard to the mDispatch.
+     **/
+    void expire(Shard& shard, const uint64_t current)
+    {
+      std::lock_guard<std::mutex> dosync(shard.mutex);
+
+      shard.schedule->expire(current, mExpired);
+
+      for(tcIterator it = mExpired.begin(); it != mExpired.end(); ++it)
+      {
+        (*it)->id = 0;
+        if((*it)->repeat == ONCE)
+        {
+          mDispatch.push_back(std::move((*it)->task));
+        }else
+        {
+          mDispatch.push_back(*it);
+        }
+      }
+      mExpired.clear();
+      resetNextWake(shard);
+    }
+
    public:
+    /**
+     * @brief refers to the scheduled timer, copyable. The handle does not
+     * keep the timer alive, the expired one-shot timer is released.
+     **/
+    class TimerHandle
+    {
+     private:
+      friend class RScheduler;
+      std::weak_ptr<Timer> mTimer;
 
-    explicit RScheduler(size_t maxthreads = 5, float overcommit = 5)
-      : mDoRun(true), mMayAdd(true), mShakePoolsTO(10000),
+      explicit TimerHandle(const timer_pointer& timer) : mTimer(timer){}
+
+     public:
+      explicit TimerHandle() : mTimer(){}
+
+      /**
+       * @return false for an empty handle or an expired one-shot timer.
+       **/
+      const bool valid() const
+      {
+        return !mTimer.expired();
+      }
+    };
+
+    /**
+     * @param maxthreads - threads of the pool the tasks are executed in
+     * @param overcommit - overcommit ratio of the pool
+     * @param backend - timers storage
+     * @param wheel_tick_us - resolution of TIMER_WHEEL in microseconds
+     * @param shards - amount of the timer structures, the threads add to
+     * the shard of their CPU (sched_getcpu() % shards). Use the number of
+     * CPUs, when many threads add timers at high rate.
+     **/
+    explicit RScheduler(size_t maxthreads = 5, float overcommit = 5,
+                        const TimerBackend backend = TIMER_MAP, const uint32_t wheel_tick_us = 100,
+                        const size_t shards = 1)
+      : mWakeup(), mDoRun(true), mMayAdd(true), mSleepUntil(0), mWoken(false),
+      mShakeAt(std::numeric_limits<uint64_t>::max()), mShards(), mCPUs(std::max(1u, std::thread::hardware_concurrency())), mExpired(), mDispatch(), mShakePoolsTO(milliseconds(10)),
       mThreadPool(std::make_shared<ThreadPoolType>(
-      maxthreads, false, overcommit
+      maxthreads, false, overcommit, ThreadPoolType::PULL
       )
       )
     {
       std::lock_guard<std::mutex> dosync(mMutex);
+      for(size_t i = 0; i < std::max(size_t(1), shards); ++i)
+      {
+        mShards.push_back(ShardPointer(new Shard(makeTimerQueue(backend, wheel_tick_us))));
+      }
       itc::getLog()->debug(__FILE__, __LINE__, "RScheduler::RScheduler()");
     }
 
@@ -88,38 +419,116 @@ namespace itc
       return ::pthread_self();
     }
 
-    const void add(uint32_t msoffset, const storable& ref)
+    /**
+     * @brief schedules the runnable to be executed once in msoffset
+     * milliseconds.
+     * @return handle of the timer, empty if the scheduler is stopped.
+     **/
+    const TimerHandle add(uint32_t msoffset, const storable& ref)
     {
-      std::lock_guard<std::mutex> dosync(mMutex);
+      return addPeriodic(msoffset, 0, ref, ONCE);
+    }
 
+    /**
+     * @brief schedules the runnable to be executed in msoffset milliseconds
+     * and then every msperiod milliseconds until cancelled.
+     * @return handle of the timer, empty if the scheduler is stopped.
+     **/
+    const TimerHandle addPeriodic(uint32_t msoffset, uint32_t msperiod, const storable& ref, const Repeat repeat = FIXED_RATE)
+    {
       if(mDoRun && mMayAdd)
       {
         itc::getLog()->debug(__FILE__, __LINE__, "in -> RScheduler::add()");
-        Date aDate;
-        Time aTime(aDate.getTime());
-        time_t usec = aTime.mTimestamp.tv_usec + msoffset * 1000;
-        time_t sec = usec / 1000000;
 
-        aTime.mTimestamp.tv_sec += sec;
-        aTime.mTimestamp.tv_usec -= (sec * 1000000);
+        if((repeat != ONCE)&&(msperiod == 0))
+        {
+          throw std::logic_error("RScheduler::addPeriodic() - the period can't be 0");
+        }
 
-        aDate.set(aTime);
+        const size_t index = getShard();
+        Shard& shard = *mShards[index];
 
-        mapIterator it = mSchedule.find(aDate);
+        timer_pointer timer(std::make_shared<Timer>(
+          this, index, ref, now() + milliseconds(msoffset),
+          (repeat == ONCE) ? 0 : milliseconds(msperiod), repeat
+        ));
 
-        if(it != mSchedule.end())
-        {
-          it->second.push_back(ref);
-        }else
+        uint64_t deadline;
         {
-          storable_container tmp;
-          tmp.push_back(ref);
-          mSchedule.insert(std::pair<Date, storable_container>(aDate, tmp));
+          std::lock_guard<std::mutex> dosync(shard.mutex);
+          deadline = arm(shard, timer);
         }
+        wakeup(deadline);
 
-        mNextWake = mSchedule.begin()->first.getTime();
         itc::getLog()->debug(__FILE__, __LINE__, "out <- RScheduler::add()");
+        return TimerHandle(timer);
+      }
+      return TimerHandle();
+    }
+
+    /**
+     * @brief removes the pending timer from the schedule, stops the
+     * periodic one (the run in progress is finished).
+     * @return false if the timer is already expired or cancelled.
+     **/
+    const bool cancel(const TimerHandle& handle)
+    {
+      timer_pointer timer(handle.mTimer.lock());
+
+      if(!timer)
+      {
+        return false;
+      }
+
+      Shard& shard = *mShards[timer->shard];
+      std::lock_guard<std::mutex> dosync(shard.mutex);
+
+      if(timer->cancelled || ((timer->id == 0)&&(timer->repeat == ONCE)))
+      {
+        return false;
+      }
+
+      timer->cancelled = true;
+      if(timer->id != 0)
+      {
+        shard.schedule->cancel(timer->id);
+        timer->id = 0;
+        resetNextWake(shard);
+      }
+      return true;
+    }
+
+    /**
+     * @brief moves the pending timer to msoffset milliseconds from now. The
+     * following runs of the periodic timer are counted from there.
+     * @return false if the timer is not pending (expired, cancelled or
+     * the periodic one is running).
+     **/
+    const bool reschedule(const TimerHandle& handle, uint32_t msoffset)
+    {
+      timer_pointer timer(handle.mTimer.lock());
+
+      if(!timer)
+      {
+        return false;
       }
+
+      Shard& shard = *mShards[timer->shard];
+      uint64_t deadline;
+      {
+        std::lock_guard<std::mutex> dosync(shard.mutex);
+
+        if(timer->id == 0)
+        {
+          return false;
+        }
+
+        shard.schedule->cancel(timer->id);
+        timer->deadline = now() + milliseconds(msoffset);
+        deadline = arm(shard, timer);
+      }
+      wakeup(deadline);
+      return true;
     }
 
     bool mayRun()
@@ -130,70 +539,77 @@ namespace itc
 
     void execute()
     {
-      ::itc::sys::Nap waithere;
-      while(mayRun())
+      // wake up at the deadlines, not within the default 50us timer slack
+      prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+      while(mDoRun)
       {
-        try
+        const uint64_t current = now();
+
+        for(auto& shard : mShards)
         {
-          std::lock_guard<std::mutex> dosync(mMutex);
-          if(!mSchedule.empty())
+          if(shard->nextWake.load() <= current)
+          {
+            expire(*shard, current);
+          }
+        }
+
+        if(!mDispatch.empty())
+        {
+          if(mShakeAt == std::numeric_limits<uint64_t>::max())
           {
-            // itc::getLog()->trace(__FILE__,__LINE__,"in -> RScheduler::execute() mSchedule is not empty");
-            if(mNextWake > mSchedule.begin()->first.getTime())
-            {
-              mNextWake = mSchedule.begin()->first.getTime();
-            }
-
-            Date aDate;
-
-            if(aDate.getTime() >= mNextWake)
-            {
-              scIterator it = mSchedule.begin()->second.begin();
-              scIterator itend = mSchedule.begin()->second.end();
-
-              while(it != itend)
-              {
-                itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] RScheduler::execute() about to be enqueued", pthread_self());
-                mThreadPool->enqueue(*it);
-                itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] RScheduler::execute() has been enqueued", pthread_self());
-                sched_yield(); // let the thread start;
-                mapIterator it1 = mSchedule.begin();
-                itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] RScheduler::execute() before remove from map", pthread_self());
-                mSchedule.erase(it1);
-                itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] RScheduler::execute() after remove from map", pthread_self());
-                if(mSchedule.begin() == mSchedule.end())
-                {
-                  break;
-                }else
-                {
-                  it = mSchedule.begin()->second.begin();
-                }
-              }
-
-              if(mSchedule.begin() != mSchedule.end())
-              {
-                mNextWake = mSchedule.begin()->first.getTime();
-              }else
-              {
-                Time future(std::numeric_limits<time_t>::max(), std::numeric_limits<time_t>::max());
-                mNextWake = future;
-              }
-            }
-            //itc::getLog()->trace(__FILE__,__LINE__,"out <- RScheduler::execute() mSchedule is not empty");
+            mShakeAt = now() + mShakePoolsTO;
           }
-        }catch(std::exception& e)
+
+          // all the timers expired at once (from all the shards) are handed
+          // over to the pool under a single pool lock
+          itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] RScheduler::execute() %ju tasks about to be enqueued", pthread_self(), mDispatch.size());
+          mThreadPool->enqueue(std::move(mDispatch));
+          continue;
+        }
+
+        if(now() >= mShakeAt)
         {
-          throw e; //rethrow
+          mShakeAt = std::numeric_limits<uint64_t>::max();
+          mThreadPool->shakePools();
+          continue;
         }
-        waithere.usleep(100);
-        mThreadPool->shakePools();
+
+        std::unique_lock<std::mutex> dosync(mMutex);
+
+        uint64_t wake = std::min(getNextWake(), mShakeAt);
+        mSleepUntil.store(wake);
+
+        // the timers added before mSleepUntil was published
+        wake = std::min(getNextWake(), mShakeAt);
+
+        if(wake == std::numeric_limits<uint64_t>::max())
+        {
+          mWakeup.wait(dosync, [this]{ return mWoken || (!mDoRun); });
+        }else
+        {
+          const uint64_t current = now();
+          if(wake > current)
+          {
+            mWakeup.wait_for(dosync, std::chrono::nanoseconds(wake - current), [this]{ return mWoken || (!mDoRun); });
+          }
+        }
+        mWoken = false;
+        mSleepUntil.store(0);
       }
     }
 
     const bool isScheduleEmpty()
     {
-      std::lock_guard<std::mutex> dosync(mMutex);
-      return mSchedule.empty();
+      for(auto& shard : mShards)
+      {
+        std::lock_guard<std::mutex> dosync(shard->mutex);
+        if(!shard->schedule->empty())
+        {
+          return false;
+        }
+      }
+      return true;
     }
 
     void onCancel()
@@ -223,14 +639,23 @@ namespace itc
 
     void stopRunning()
     {
-      mDoRun = false;
+      {
+        std::lock_guard<std::mutex> dosync(mMutex);
+        mDoRun = false;
+        mWoken = true;
+      }
+      mWakeup.notify_all();
     }
 
     void clearSchedule()
     {
-      std::lock_guard<std::mutex> dosync(mMutex);
       itc::getLog()->debug(__FILE__, __LINE__, "trace <- out <- RScheduler::clearSchedule()");
-      mSchedule.clear();
+      for(auto& shard : mShards)
+      {
+        std::lock_guard<std::mutex> dosync(shard->mutex);
+        shard->schedule->clear();
+        resetNextWake(*shard);
+      }
     }
   };
 }
@@ -0,0 +1,192 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: RingQueue.h 1 2021-03-18 19:14:52Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __RINGQUEUE_H__
+#  define __RINGQUEUE_H__
+
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <stdexcept>
+
+namespace itc
+{
+  /**
+   * @brief FIFO on a growable power-of-two ring buffer, a drop-in for the
+   * std::queue subset used by tsqueue and tsbqueue. The ring doubles when
+   * it is full and never shrinks, so after the warm-up (once the queue
+   * has seen its peak depth) push() and pop() do not allocate.
+   *
+   * This class is not thread safe, the owner must synchronize access.
+   **/
+  template <typename T> class RingQueue
+  {
+   private:
+    T*      mBuffer;
+    size_t  mCapacity;
+    size_t  mHead;
+    size_t  mSize;
+
+    static size_t roundUp(const size_t capacity)
+    {
+      size_t result = 2;
+      while(result < capacity) result <<= 1;
+      return result;
+    }
+
+    static T* allocate(const size_t capacity)
+    {
+      return static_cast<T*>(::operator new(capacity * sizeof(T)));
+    }
+
+    T* slot(const size_t pos) const
+    {
+      return mBuffer + ((mHead + pos) & (mCapacity - 1));
+    }
+
+    /**
+     * @brief moves the elements into a buffer of the given capacity and
+     * releases the old one.
+     **/
+    void relocate(T* buffer, const size_t capacity)
+    {
+      for(size_t i = 0; i < mSize; ++i)
+      {
+        T* from = slot(i);
+        new (buffer + i) T(std::move(*from));
+        from->~T();
+      }
+      ::operator delete(mBuffer);
+
+      mBuffer = buffer;
+      mCapacity = capacity;
+      mHead = 0;
+    }
+
+    /**
+     * @brief appends the value. When the ring is full the new element is
+     * constructed in the new buffer before the old one is released, so
+     * pushing a reference to an element of this queue is safe.
+     **/
+    template <typename U> void append(U&& value)
+    {
+      if(mSize < mCapacity)
+      {
+        new (slot(mSize)) T(std::forward<U>(value));
+        ++mSize;
+        return;
+      }
+
+      const size_t capacity = mCapacity << 1;
+      T* buffer = allocate(capacity);
+      try
+      {
+        new (buffer + mSize) T(std::forward<U>(value));
+      }catch(...)
+      {
+        ::operator delete(buffer);
+        throw;
+      }
+      relocate(buffer, capacity);
+      ++mSize;
+    }
+
+   public:
+    typedef T value_type;
+
+    explicit RingQueue(const size_t capacity = 16)
+    : mBuffer(nullptr), mCapacity(roundUp(capacity)), mHead(0), mSize(0)
+    {
+      mBuffer = allocate(mCapacity);
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue(RingQueue&) = delete;
+
+    ~RingQueue()
+    {
+      clear();
+      ::operator delete(mBuffer);
+    }
+
+    void push(const T& ref)
+    {
+      append(ref);
+    }
+
+    void push(T&& ref)
+    {
+      append(std::move(ref));
+    }
+
+    T& front()
+    {
+      if(mSize == 0)
+        throw std::logic_error("RingQueue<T>::front() - the queue is empty");
+      return *slot(0);
+    }
+
+    void pop()
+    {
+      if(mSize == 0)
+        throw std::logic_error("RingQueue<T>::pop() - the queue is empty");
+      slot(0)->~T();
+      mHead = (mHead + 1) & (mCapacity - 1);
+      --mSize;
+    }
+
+    const bool empty() const
+    {
+      return mSize == 0;
+    }
+
+    const size_t size() const
+    {
+      return mSize;
+    }
+
+    /**
+     * @return amount of elements the ring holds without allocation.
+     **/
+    const size_t capacity() const
+    {
+      return mCapacity;
+    }
+
+    /**
+     * @brief destroys all elements, keeps the memory.
+     **/
+    void clear()
+    {
+      while(mSize > 0)
+      {
+        pop();
+      }
+      mHead = 0;
+    }
+
+    void swap(RingQueue& other)
+    {
+      std::swap(mBuffer, other.mBuffer);
+      std::swap(mCapacity, other.mCapacity);
+      std::swap(mHead, other.mHead);
+      std::swap(mSize, other.mSize);
+    }
+  };
+
+  template <typename T> void swap(RingQueue<T>& a, RingQueue<T>& b)
+  {
+    a.swap(b);
+  }
+}
+
+#endif /* __RINGQUEUE_H__ */
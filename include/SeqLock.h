@@ -0,0 +1,101 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: SeqLock.h 1 2021-04-04 10:12:45Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __SEQLOCK_H__
+#  define __SEQLOCK_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <sched.h>
+
+namespace itc
+{
+  /**
+   * @brief single writer, many readers value. The writer never waits, the
+   * readers never block the writer, they retry if the value was changed
+   * while it was copied. The value is kept in the atomic words, so the
+   * concurrent copies are not data races.
+   *
+   * Concurrent writers must be serialized by the owner.
+   **/
+  template <typename T> class SeqLock
+  {
+   private:
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock<T> - T must be trivially copyable");
+
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> mSequence;
+    std::atomic<uint64_t> mWords[WORDS];
+
+   public:
+    explicit SeqLock(const T& value = T()) : mSequence{0}
+    {
+      for(size_t i = 0; i < WORDS; ++i)
+      {
+        mWords[i].store(0, std::memory_order_relaxed);
+      }
+      write(value);
+    }
+
+    SeqLock(const SeqLock&)=delete;
+    SeqLock(SeqLock&)=delete;
+
+    void write(const T& value)
+    {
+      uint64_t words[WORDS] = {};
+      std::memcpy(words, &value, sizeof(T));
+
+      const uint64_t sequence = mSequence.load(std::memory_order_relaxed);
+      mSequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      for(size_t i = 0; i < WORDS; ++i)
+      {
+        mWords[i].store(words[i], std::memory_order_relaxed);
+      }
+      mSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    const T read() const
+    {
+      uint64_t words[WORDS];
+      uint64_t before;
+      uint64_t after;
+
+      do
+      {
+        before = mSequence.load(std::memory_order_acquire);
+        if(before & 1)
+        {
+          sched_yield();
+          after = before + 1;
+          continue;
+        }
+        for(size_t i = 0; i < WORDS; ++i)
+        {
+          words[i] = mWords[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = mSequence.load(std::memory_order_relaxed);
+      }while(before != after);
+
+      T result;
+      std::memcpy(&result, words, sizeof(T));
+      return result;
+    }
+  };
+}
+
+#endif /* __SEQLOCK_H__ */
@@ -13,16 +13,25 @@
 #include <memory>
 #include <Val2Type.h>
 #include <list>
+#include <vector>
+#include <iterator>
 #include <algorithm>
 #include <abstract/Runnable.h>
 #include <abstract/IThreadPool.h>
+#include <PriorityTaskQueue.h>
+#include <PoolMetrics.h>
+#include <CPUTopology.h>
+#include <Singleton.h>
 #include <sys/PThread.h>
 #include <TSLog.h>
 #include <queue>
 #include <mutex>
 #include <atomic>
+#include <stdexcept>
+#include <cerrno>
 #include <sys/mutex.h>
 #include <sys/synclock.h>
+#include <condition_variable>
 
 
 
@@ -41,29 +50,73 @@ namespace itc
    * You does not need this class without a itc::ThreadPoolManager. So instantiate
    * itc::ThreadPoolManager, which will create an instance of itc::ThreadPool 
    * within itself and will effectively manage the threads in a pool.
+   * 
+   * In the PULL dispatch mode every thread runs a worker loop, which takes
+   * the next task from the task queue itself as soon as the previous one is done
+   * and sleeps on a condition variable while the queue is empty. There is no
+   * need to call shakePools() in this mode other than to collect the threads
+   * retired after reduce() or autotune overcommit.
+   * 
+   * The placement policy binds the threads to CPUs: PIN_CORES pins every 
+   * thread to its own core (cores are taken node by node), SPREAD_NODES binds
+   * the threads round-robin to the NUMA nodes. NODE_SHARDS does the same and
+   * keeps a separate task queue per node: the task is queued on the node of
+   * the enqueuing thread and the workers of that node are woken up first.
+   * The workers take tasks from the other nodes only if their own queue is
+   * empty.
    **/
   class ThreadPool : public abstract::IThreadPool
   {
    public:
     typedef ::itc::sys::PThread::TaskType TaskType;
     typedef std::shared_ptr<sys::PThread> ThreadPTR;
-    typedef std::list<ThreadPTR>::iterator ThreadListIterator;
+
+   private:
+    struct Worker;
+    typedef std::shared_ptr<Worker> WorkerPTR;
+
+   public:
+    typedef std::list<WorkerPTR>::iterator ThreadListIterator;
+
+    enum DispatchMode { POLL, PULL };
+    enum PlacementPolicy { NO_PLACEMENT, PIN_CORES, SPREAD_NODES, NODE_SHARDS };
 
     explicit ThreadPool(
-      const size_t maxthreads = 10, bool autotune = true, float overcommit = 1.2
+      const size_t maxthreads = 10, bool autotune = true, float overcommit = 1.2,
+      const DispatchMode mode = POLL, const PlacementPolicy placement = NO_PLACEMENT
       ) : mMutex(), mMaxThreads(maxthreads), mMinThreads(maxthreads), 
       mAutotune(autotune), mOvercommitRatio(overcommit), doRun(true),
-      mInQueueDepth{0}
+      mInQueueDepth{0}, mEnqueued{0}, mMode(mode), mPlacement(placement),
+      mTopology(Singleton<CPUTopology>::getInstance()), mShards(), 
+      mWorkers{0}, mIdleWorkers{0}, mSpawned{0},
+      mFinished(std::make_shared<FinishedStack>()),
+      mMetrics(std::make_shared<PoolMetrics>()), mSettling()
     {
       ITCSyncLock dosync(mMutex);
+      const size_t shards = (mPlacement == NODE_SHARDS) ? mTopology->getNodesCount() : 1;
+      for(size_t i = 0; i < shards; ++i)
+      {
+        mShards.emplace_back(new Shard());
+      }
       ::itc::getLog()->debug(
         __FILE__, __LINE__,
-        "created ThreadPool::ThreadPool(%ju,%u,%f)",
-        size_t(mMaxThreads), bool(mAutotune), float(mOvercommitRatio)
+        "created ThreadPool::ThreadPool(%ju,%u,%f,%s,%u) with %ju task queue(s)",
+        size_t(mMaxThreads), bool(mAutotune), float(mOvercommitRatio),
+        (mMode == PULL ? "PULL" : "POLL"), unsigned(mPlacement), shards
         );
       spawnThreads(mMaxThreads);
     }
 
+    const DispatchMode getDispatchMode() const
+    {
+      return mMode;
+    }
+
+    const PlacementPolicy getPlacementPolicy() const
+    {
+      return mPlacement;
+    }
+
     const bool getAutotune() const
     {
       return mAutotune;
@@ -87,19 +140,83 @@ namespace itc
 
     const size_t getThreadsCount() const
     {
-      return mActiveThreads.size() + mPassiveThreads.size();
+      ITCSyncLock dosync(mMutex);
+      return threadsCount();
     }
 
     const size_t getActiveThreadsCount() const
     {
+      if(mMode == PULL)
+      {
+        return mWorkers - std::min(mIdleWorkers.load(), mWorkers.load());
+      }
+      ITCSyncLock dosync(mMutex);
       return mActiveThreads.size();
     }
 
     const size_t getPassiveThreadsCount() const
     {
+      if(mMode == PULL)
+      {
+        return mIdleWorkers;
+      }
+      ITCSyncLock dosync(mMutex);
       return mPassiveThreads.size();
     }
 
+    /**
+     * @brief fills the stats of the pool under a single lock, so the counts
+     * are consistent with each other.
+     **/
+    void getStats(tpstats& stats) const
+    {
+      ITCSyncLock dosync(mMutex);
+      stats.tqdp = mInQueueDepth.load();
+      stats.tc = threadsCount();
+      if(mMode == PULL)
+      {
+        stats.tpc = mIdleWorkers;
+        stats.tac = mWorkers - std::min(mIdleWorkers.load(), mWorkers.load());
+      }else
+      {
+        stats.tpc = mPassiveThreads.size();
+        stats.tac = mActiveThreads.size();
+      }
+      stats.maxthreads = mMaxThreads;
+      stats.overcommit = mOvercommitRatio;
+      stats.enqueued = mEnqueued.load();
+      stats.completed = mMetrics->getCompleted();
+      stats.timestamp = TaskClock::nanoseconds();
+    }
+
+    /**
+     * @brief copies the histogram of the time the tasks have waited in the
+     * queue, without the pool's lock.
+     **/
+    void getWaitHistogram(histogram& out) const
+    {
+      mMetrics->getWaitHistogram(out);
+    }
+
+    /**
+     * @brief copies the histogram of the execution time of the tasks,
+     * without the pool's lock.
+     **/
+    void getExecHistogram(histogram& out) const
+    {
+      mMetrics->getExecHistogram(out);
+    }
+
+    /**
+     * @brief logs the tasks (with the type of the Runnable) which run
+     * threshold_ns or longer, every n-th of them. 0 turns the log off.
+     * No-op if the task timing is compiled out (ITC_TASK_TIMING=0).
+     **/
+    void setSlowTaskLog(const uint64_t threshold_ns, const uint64_t every = 1)
+    {
+      mMetrics->setSlowTaskLog(threshold_ns, every);
+    }
+
     const bool mayRun() const
     {
       return doRun;
@@ -111,8 +228,7 @@ namespace itc
       if(mayRun())
       {
         mMaxThreads += inc;
-        for(size_t i = 0; i < inc; i++)
-          mPassiveThreads.push(std::make_shared<sys::PThread>());
+        spawnThreads(inc);
       }
     }
 
@@ -122,24 +238,21 @@ namespace itc
       if(mMaxThreads > mMinThreads)
       {
         mMaxThreads -= dec;
+        if(mMode == PULL)
+        {
+          notifyAll();
+        }
       }
     }
 
     const size_t getFreeThreadsCount()
     {
+      if(mMode == PULL)
+      {
+        return mIdleWorkers;
+      }
       ITCSyncLock dosync(mMutex);
-      size_t ftc = 0;
-      std::for_each(
-        mActiveThreads.begin(),
-        mActiveThreads.end(),
-        [&ftc](const std::shared_ptr<itc::sys::PThread>& sptr){
-          if(sptr.get()->getState() == DONE)
-          {
-            ftc++;
-          }
-        }
-      );
-      return mPassiveThreads.size() + ftc;
+      return mPassiveThreads.size() + mFinished->size();
     }
 
     void shakePools()
@@ -150,15 +263,20 @@ namespace itc
       {
         shakePoolsPrivate();
 
-        if(mPassiveThreads.empty()&&(!mTaskQueue.empty()) && mAutotune)
+        if(mMode == PULL)
+        {
+          return;
+        }
+
+        if(mPassiveThreads.empty()&&(mInQueueDepth > 0) && mAutotune)
         {
           size_t absMax = (size_t) (mMaxThreads * mOvercommitRatio);
             
-          size_t max_start = absMax - getThreadsCount();
+          size_t max_start = absMax - threadsCount();
 
           spawnThreads(max_start);
         }
-        while((!mPassiveThreads.empty())&&(!mTaskQueue.empty()))
+        while((!mPassiveThreads.empty())&&(mInQueueDepth > 0))
         {
           enqueuePrivate();
         }
@@ -166,15 +284,30 @@ namespace itc
     }
 
     void enqueue(const value_type& ref)
+    {
+      enqueue(ref, NORMAL);
+    }
+
+    /**
+     * @brief enqueues the Runnable with the given priority. The tasks of
+     * the same priority are executed in FIFO order, the lower priorities
+     * are protected from starvation by the PriorityTaskQueue.
+     **/
+    void enqueue(const value_type& ref, const TaskPriority priority)
     {
       ITCSyncLock dosync(mMutex);
 
       if(mayRun())
       {
-        mTaskQueue.push(ref);
+        const size_t shard = getEnqueueShard();
+        mShards[shard]->queue.push(QueuedTask(ref, PoolMetrics::stamp()), priority);
         mInQueueDepth++;
+        mEnqueued++;
         itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] ThreadPool::enqueue() the Runnable is enqueued", pthread_self());
-        if(!mPassiveThreads.empty())
+        if(mMode == PULL)
+        {
+          wakeWorkers(1, shard);
+        }else if(!mPassiveThreads.empty())
         {
           itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] ThreadPool::enqueue() the Runnable will be assigned to the thread now", pthread_self());
           enqueuePrivate();
@@ -183,10 +316,83 @@ namespace itc
       }
     }
 
+    /**
+     * @brief enqueues a batch of Runnables under a single lock and wakes up
+     * (or assigns threads to) as many workers as needed.
+     **/
+    template <typename InputIterator> void enqueue(
+      InputIterator first, InputIterator last, const TaskPriority priority = NORMAL)
+    {
+      ITCSyncLock dosync(mMutex);
+
+      if(mayRun())
+      {
+        const size_t shard = getEnqueueShard();
+        const uint64_t timestamp = PoolMetrics::stamp();
+        size_t count = 0;
+        for(; first != last; ++first, ++count)
+        {
+          mShards[shard]->queue.push(QueuedTask(*first, timestamp), priority);
+        }
+        mInQueueDepth += count;
+        mEnqueued += count;
+        itc::getLog()->trace(__FILE__, __LINE__, "Thread [%jx] ThreadPool::enqueue() %ju Runnables are enqueued", pthread_self(), count);
+        if(mMode == PULL)
+        {
+          wakeWorkers(count, shard);
+        }else
+        {
+          while((!mPassiveThreads.empty())&&(mInQueueDepth > 0))
+          {
+            enqueuePrivate();
+          }
+        }
+      }
+    }
+
+    void enqueue(std::vector<value_type>&& batch)
+    {
+      enqueue(std::move(batch), NORMAL);
+    }
+
+    void enqueue(std::vector<value_type>&& batch, const TaskPriority priority)
+    {
+      enqueue(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()), priority);
+      batch.clear();
+    }
+
     const size_t getTaskQueueDepth()
     {
       return mInQueueDepth.load();
     }
+
+    /**
+     * @return amount of the tasks enqueued since the pool is created, the
+     * arrival rate is its derivative.
+     **/
+    const uint64_t getEnqueuedCount() const
+    {
+      return mEnqueued.load();
+    }
+
+    /**
+     * @return amount of the tasks executed (or thrown) since the pool is
+     * created, the throughput is its derivative.
+     **/
+    const uint64_t getCompletedCount() const
+    {
+      return mMetrics->getCompleted();
+    }
+
+    const size_t getTaskQueueDepth(const TaskPriority priority) const
+    {
+      size_t depth = 0;
+      for(const auto& shard : mShards)
+      {
+        depth += shard->queue.size(priority);
+      }
+      return depth;
+    }
     
     void stopPool()
     {
@@ -201,47 +407,485 @@ namespace itc
     }
 
    private:
-    itc::sys::mutex mMutex;
+    /**
+     * @brief a thread of the pool. The worker knows its position in the
+     * mActiveThreads, and it is linked into the FinishedStack when its task
+     * is done, so the pool never has to scan for the finished threads.
+     **/
+    struct Worker
+    {
+      ThreadPTR          thread;
+      ThreadListIterator pos;
+      Worker*            next;
+      size_t             shard;
+      std::vector<int>   cpus;
+      bool               placed;
+      
+      explicit Worker() 
+      : thread(std::make_shared<sys::PThread>()), pos(), next(nullptr), 
+        shard(0), cpus(), placed(false){}
+      
+      /**
+       * @brief binds the calling thread (the worker's own) to the worker's
+       * CPUs once.
+       **/
+      void place()
+      {
+        if(!placed)
+        {
+          placed = true;
+          if(!cpus.empty())
+          {
+            const int error = CPUTopology::bind(cpus);
+            if(error != 0)
+            {
+              ::itc::getLog()->error(
+                __FILE__, __LINE__,
+                "ThreadPool::Worker::place() - can't set the thread affinity, error: %d", error
+              );
+            }
+          }
+        }
+      }
+    };
+    
+    /**
+     * @brief the task and the time it was enqueued at, for the queue wait
+     * histogram.
+     **/
+    struct QueuedTask
+    {
+      TaskType task;
+      uint64_t enqueued;
+
+      explicit QueuedTask() : task(), enqueued(0){}
+      explicit QueuedTask(const TaskType& ref, const uint64_t timestamp)
+      : task(ref), enqueued(timestamp){}
+      explicit QueuedTask(TaskType&& ref, const uint64_t timestamp)
+      : task(std::move(ref)), enqueued(timestamp){}
+    };
+
+    /**
+     * @brief the task queue of a NUMA node (the only one if the placement
+     * policy is not NODE_SHARDS) and the event its idle workers wait on.
+     **/
+    struct Shard
+    {
+      PriorityTaskQueue<QueuedTask> queue;
+      std::condition_variable_any   event;
+      size_t                        idle;
+      
+      explicit Shard() : queue(), event(), idle(0){}
+    };
+    
+    /**
+     * @brief lock-free intrusive stack of the workers which have finished
+     * their tasks. Pushed by the workers, drained by shakePoolsPrivate() 
+     * all at once, so there is no ABA problem.
+     **/
+    class FinishedStack
+    {
+     private:
+      std::atomic<Worker*> mHead;
+      std::atomic<size_t>  mCount;
+     public:
+      explicit FinishedStack() : mHead{nullptr}, mCount{0}{}
+      
+      void push(Worker* worker)
+      {
+        mCount.fetch_add(1);
+        worker->next = mHead.load(std::memory_order_relaxed);
+        while(!mHead.compare_exchange_weak(
+          worker->next, worker, std::memory_order_release, std::memory_order_relaxed));
+      }
+      
+      Worker* takeAll()
+      {
+        if(mHead.load(std::memory_order_relaxed) == nullptr)
+        {
+          return nullptr;
+        }
+        return mHead.exchange(nullptr, std::memory_order_acquire);
+      }
+      
+      /**
+       * @brief must be called for every worker which has left the stack
+       * and the settling list.
+       **/
+      void recycled(const size_t n = 1)
+      {
+        mCount.fetch_sub(n);
+      }
+      
+      const size_t size() const
+      {
+        return mCount.load();
+      }
+    };
+    typedef std::shared_ptr<FinishedStack> FinishedStackPTR;
+    typedef std::shared_ptr<PoolMetrics> PoolMetricsPTR;
+    
+    /**
+     * @brief reports the worker to the FinishedStack after the task is done.
+     **/
+    static void finished(const std::weak_ptr<Worker>& worker, const FinishedStackPTR& stack)
+    {
+      WorkerPTR aWorker = worker.lock();
+      if(aWorker)
+      {
+        stack->push(aWorker.get());
+      }
+    }
+    
+    /**
+     * @brief the wrapper of a task in the POLL dispatch mode.
+     **/
+    class TrackedTask : public abstract::IRunnable
+    {
+     private:
+      TaskType              mTask;
+      uint64_t              mEnqueued;
+      std::weak_ptr<Worker> mWorker;
+      FinishedStackPTR      mFinished;
+      PoolMetricsPTR        mMetrics;
+     public:
+      explicit TrackedTask(QueuedTask&& queued, const WorkerPTR& worker, const FinishedStackPTR& stack,
+                           const PoolMetricsPTR& metrics)
+      : mTask(std::move(queued.task)), mEnqueued(queued.enqueued), mWorker(worker), 
+        mFinished(stack), mMetrics(metrics){}
+      
+      void execute()
+      {
+        {
+          WorkerPTR aWorker = mWorker.lock();
+          if(aWorker)
+          {
+            aWorker->place();
+          }
+        }
+        const uint64_t started = PoolMetrics::stamp();
+        try
+        {
+          mTask->execute();
+        }catch(...)
+        {
+          mMetrics->completed(mEnqueued, started, *mTask);
+          mTask.reset();
+          finished(mWorker, mFinished);
+          throw;
+        }
+        mMetrics->completed(mEnqueued, started, *mTask);
+        mTask.reset();
+        finished(mWorker, mFinished);
+      }
+      
+      void onCancel()
+      {
+        TaskType task(mTask);
+        if(task)
+        {
+          task->onCancel();
+        }
+      }
+      
+      void shutdown()
+      {
+        TaskType task(mTask);
+        if(task)
+        {
+          task->shutdown();
+        }
+      }
+    };
+    
+    /**
+     * @brief the worker loop of the PULL dispatch mode. Runs the tasks from
+     * the pool's queue until the pool is stopped or the thread is retired.
+     **/
+    class PullWorker : public abstract::IRunnable
+    {
+     private:
+      ThreadPool*           mPool;
+      std::weak_ptr<Worker> mWorker;
+      FinishedStackPTR      mFinished;
+      PoolMetricsPTR        mMetrics;
+     public:
+      explicit PullWorker(ThreadPool* pool, const WorkerPTR& worker)
+      : mPool(pool), mWorker(worker), mFinished(pool->mFinished), mMetrics(pool->mMetrics){}
+      
+      void execute()
+      {
+        Worker* self = nullptr;
+        {
+          // the Worker outlives its thread, it must not be kept by the
+          // thread's own runnable
+          WorkerPTR aWorker = mWorker.lock();
+          if(!aWorker)
+          {
+            return;
+          }
+          self = aWorker.get();
+        }
+        self->place();
+        
+        QueuedTask queued;
+        while((queued = mPool->pull(self)).task)
+        {
+          TaskType task(std::move(queued.task));
+          const uint64_t started = PoolMetrics::stamp();
+          try
+          {
+            task->execute();
+          }catch(const std::exception& e)
+          {
+            ::itc::getLog()->error(
+              __FILE__, __LINE__,
+              "ThreadPool::PullWorker::execute() - the Runnable has thrown an exception: %s",
+              e.what()
+            );
+          }catch(...)
+          {
+            ::itc::getLog()->error(
+              __FILE__, __LINE__,
+              "ThreadPool::PullWorker::execute() - the Runnable has thrown an unknown exception"
+            );
+          }
+          mMetrics->completed(queued.enqueued, started, *task);
+          task.reset();
+        }
+        finished(mWorker, mFinished);
+      }
+      
+      void onCancel()
+      {
+      }
+      
+      void shutdown()
+      {
+      }
+    };
+
+    mutable itc::sys::mutex mMutex;
     std::atomic<size_t>   mMaxThreads;
     std::atomic<size_t>   mMinThreads;
     std::atomic<bool>     mAutotune;
     std::atomic<float>    mOvercommitRatio;
-    std::queue<TaskType>  mTaskQueue;
-    std::list<ThreadPTR>  mActiveThreads;
-    std::queue<ThreadPTR> mPassiveThreads;
+    std::list<WorkerPTR>  mActiveThreads;
+    std::queue<WorkerPTR> mPassiveThreads;
     std::atomic<bool>     doRun;
     std::atomic<size_t>   mInQueueDepth;
+    std::atomic<uint64_t> mEnqueued;
+    const DispatchMode    mMode;
+    const PlacementPolicy mPlacement;
+    std::shared_ptr<CPUTopology> mTopology;
+    std::vector<std::unique_ptr<Shard>> mShards;
+    std::atomic<size_t>   mWorkers;
+    std::atomic<size_t>   mIdleWorkers;
+    size_t                mSpawned;
+    FinishedStackPTR      mFinished;
+    PoolMetricsPTR        mMetrics;
+    std::vector<Worker*>  mSettling;
+
+    /**
+     * @brief must be called under the mMutex lock.
+     **/
+    const size_t threadsCount() const
+    {
+      return mActiveThreads.size() + mPassiveThreads.size();
+    }
 
     void spawnThreads(size_t n)
     {
       for(size_t i = 0; i < n; i++)
       {
-        mPassiveThreads.push(std::make_shared<sys::PThread>());
+        auto aWorker = std::make_shared<Worker>();
+        placeWorker(aWorker, mSpawned++);
+        if(mMode == PULL)
+        {
+          ++mWorkers;
+          aWorker->pos = mActiveThreads.insert(mActiveThreads.end(), aWorker);
+          aWorker->thread->setRunnable(std::make_shared<PullWorker>(this, aWorker));
+        }else
+        {
+          mPassiveThreads.push(std::move(aWorker));
+        }
       }
     }
 
-    void shakePoolsPrivate()
+    /**
+     * @brief assigns the shard and the CPUs to the n-th spawned worker
+     * according to the placement policy.
+     **/
+    void placeWorker(const WorkerPTR& aWorker, const size_t n)
     {
-      ThreadListIterator it = mActiveThreads.begin();
+      switch(mPlacement)
+      {
+        case PIN_CORES:
+        {
+          const auto& cpus = mTopology->getCPUs();
+          const int cpu = cpus[n % cpus.size()];
+          aWorker->cpus.push_back(cpu);
+          aWorker->shard = 0;
+          break;
+        }
+        case SPREAD_NODES:
+        case NODE_SHARDS:
+        {
+          const size_t node = n % mTopology->getNodesCount();
+          aWorker->cpus = mTopology->getCPUs(node);
+          aWorker->shard = (mPlacement == NODE_SHARDS) ? node : 0;
+          break;
+        }
+        default:
+          aWorker->shard = 0;
+          break;
+      }
+    }
 
-      while(it != mActiveThreads.end())
+    /**
+     * @return the shard for the task enqueued by the calling thread.
+     **/
+    const size_t getEnqueueShard() const
+    {
+      if(mShards.size() == 1)
       {
-        if(it->get()->getState() == DONE)
+        return 0;
+      }
+      return mTopology->getCurrentNode() % mShards.size();
+    }
+
+    /**
+     * @brief takes a task from the preferred shard, or from any other 
+     * non-empty one. Must be called under the mMutex lock with 
+     * mInQueueDepth > 0.
+     **/
+    QueuedTask takeTask(const size_t preferred)
+    {
+      for(size_t i = 0; i < mShards.size(); ++i)
+      {
+        Shard& shard = *mShards[(preferred + i) % mShards.size()];
+        if(!shard.queue.empty())
         {
-          if((getThreadsCount() > mMaxThreads)&&(mTaskQueue.empty()))
-          {
-            mActiveThreads.erase(it);
-          }else
+          mInQueueDepth--;
+          return shard.queue.take();
+        }
+      }
+      throw std::logic_error("ThreadPool::takeTask() - the task queues are empty");
+    }
+
+    void notifyAll()
+    {
+      for(auto& shard : mShards)
+      {
+        shard->event.notify_all();
+      }
+    }
+
+    /**
+     * @brief wakes up to n idle workers, the workers of the given shard 
+     * first, and spawns up to n workers in the autotune mode if there are
+     * no idle ones. Must be called under the mMutex lock.
+     **/
+    void wakeWorkers(size_t n, const size_t preferred)
+    {
+      if(mIdleWorkers == 0)
+      {
+        size_t absMax = (size_t) (mMaxThreads * mOvercommitRatio);
+        if(mAutotune && (threadsCount() < absMax))
+        {
+          spawnThreads(std::min(n, absMax - threadsCount()));
+        }
+        return;
+      }
+
+      for(size_t i = 0; (i < mShards.size())&&(n > 0); ++i)
+      {
+        Shard& shard = *mShards[(preferred + i) % mShards.size()];
+        if(n >= shard.idle)
+        {
+          shard.event.notify_all();
+          n -= shard.idle;
+        }else
+        {
+          for(; n > 0; --n)
           {
-            mPassiveThreads.push(*it);
-            mActiveThreads.erase(it);
+            shard.event.notify_one();
           }
-          it = mActiveThreads.begin();
-        }else if(it->get()->getState() == CANCEL)
+        }
+      }
+    }
+
+    /**
+     * @brief takes the next task for a worker of the PULL dispatch mode,
+     * blocks while the queues are empty.
+     * 
+     * @return the task, its task pointer is empty if the worker must exit.
+     **/
+    QueuedTask pull(Worker* aWorker)
+    {
+      std::unique_lock<itc::sys::mutex> dosync(mMutex);
+      Shard& own = *mShards[aWorker->shard];
+
+      while(mayRun())
+      {
+        if(mInQueueDepth > 0)
         {
-          mActiveThreads.erase(it);
-          it = mActiveThreads.begin();
-        }else ++it;
+          return takeTask(aWorker->shard);
+        }
+
+        if(mWorkers > mMaxThreads)
+        {
+          --mWorkers;
+          return QueuedTask();
+        }
+
+        ++mIdleWorkers;
+        ++own.idle;
+        own.event.wait(dosync);
+        --own.idle;
+        --mIdleWorkers;
+      }
+      --mWorkers;
+      return QueuedTask();
+    }
+
+    /**
+     * @brief moves the finished workers to mPassiveThreads, or retires them.
+     * Only the workers reported to mFinished are visited. A worker whose 
+     * PThread is not in the DONE state yet stays in mSettling until the next
+     * shake.
+     **/
+    void shakePoolsPrivate()
+    {
+      Worker* aFinished = mFinished->takeAll();
+      while(aFinished != nullptr)
+      {
+        mSettling.push_back(aFinished);
+        aFinished = aFinished->next;
+      }
+
+      size_t i = 0;
+      while(i < mSettling.size())
+      {
+        Worker* aWorker = mSettling[i];
+        const auto state = aWorker->thread->getState();
+
+        if((state == DONE)||(state == CANCEL))
+        {
+          WorkerPTR ptr(*(aWorker->pos));
+          mActiveThreads.erase(aWorker->pos);
+
+          if((state == DONE)&&(mMode == POLL)&&
+             ((threadsCount() < mMaxThreads)||(mInQueueDepth > 0)))
+          {
+            mPassiveThreads.push(std::move(ptr));
+          }
+          // else the worker has left the loop or it is a surplus, it is retired
+
+          mSettling[i] = mSettling.back();
+          mSettling.pop_back();
+          mFinished->recycled();
+        }else ++i;
       }
 
       while(mPassiveThreads.size() > mMaxThreads)
@@ -253,39 +897,48 @@ namespace itc
     void cleanInQueue()
     {
       ITCSyncLock dosync(mMutex);
-      while(!mTaskQueue.empty())
+      for(auto& shard : mShards)
       {
-        mTaskQueue.pop();
+        shard->queue.clear();
       }
+      mInQueueDepth.store(0);
     }
 
     void enqueuePrivate()
     {
       if(!mPassiveThreads.empty())
       {
-        auto aThread = std::move(mPassiveThreads.front());
-        mPassiveThreads.pop();
-        if(!mTaskQueue.empty())
+        if(mInQueueDepth > 0)
         {
-          aThread->setRunnable(std::move(mTaskQueue.front()));
-          mTaskQueue.pop();
-          mInQueueDepth--;
+          auto aWorker = std::move(mPassiveThreads.front());
+          mPassiveThreads.pop();
+          aWorker->pos = mActiveThreads.insert(mActiveThreads.end(), aWorker);
+          aWorker->thread->setRunnable(
+            std::make_shared<TrackedTask>(takeTask(aWorker->shard), aWorker, mFinished, mMetrics)
+          );
         }
-        mActiveThreads.push_back(std::move(aThread));
       }
     }
 
     void stopRunning()
     {
+      ITCSyncLock dosync(mMutex);
       doRun = false;
+      notifyAll();
     }
 
     void onShutdown()
     {
-      ITCSyncLock dosync(mMutex);
-      while(!mPassiveThreads.empty())
-        mPassiveThreads.pop();
-      mActiveThreads.clear();
+      // the threads are destroyed out of the lock, the PULL workers
+      // need mMutex to leave the pull()
+      std::list<WorkerPTR>  active;
+      std::queue<WorkerPTR> passive;
+      {
+        ITCSyncLock dosync(mMutex);
+        mSettling.clear();
+        std::swap(mPassiveThreads, passive);
+        std::swap(mActiveThreads, active);
+      }
     }
   };
 }
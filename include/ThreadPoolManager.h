@@ -23,18 +23,15 @@
 #include <mutex>
 #include <cmath>
 #include <atomic>
+#include <vector>
+#include <PoolMetrics.h>
+#include <SeqLock.h>
+#include <abstract/IScalingStrategy.h>
+#include <HeuristicScaling.h>
+#include <FeedbackScaling.h>
 
 namespace itc
 {
-  struct tpstats
-  {
-    size_t tqdp;
-    size_t tc;
-    size_t tpc;
-    size_t tac;
-    size_t maxthreads;
-    float  overcommit;
-  };
   /**
    * @brief This class manages an instance of the itc::ThreadPool class. 
    * The default behavior is to expand threads within a itc::ThreadPool instance 
@@ -45,6 +42,18 @@ namespace itc
    * is defined by itc::ThreadPoolManager.mMaxThreads + 
    * itc::ThreadPoolManager.mOvercommitThreads. Right now this class is too 
    * simple for soft and hard upper limit, which will be changed later
+   *
+   * The behavior above is the HeuristicScaling strategy, it can be replaced
+   * with setScalingStrategy(), e.g. with the FeedbackScaling control loop:
+   *
+   *    manager.setScalingStrategy(
+   *      std::make_shared<FeedbackScaling>(min_thr_ready, maxthreads + overcommit)
+   *    );
+   *
+   * The state of the pool is published once per sample as a tpsnapshot
+   * (consistent thread counts, arrival rate and throughput, queue wait and
+   * execution time histograms). getSnapshot() reads it without locks, so
+   * the metrics exporters never stall the pool or the manager.
    * 
    * @TODO Need to add functionality to manage thread pool on time-line and resource
    * usage.
@@ -61,9 +70,36 @@ namespace itc
     size_t                      mMinReadyThr;
     size_t                      mOvercommitThreads;
     tpstats                     mTPStats;
+    tpstats                     mLastStats;
+    SeqLock<tpsnapshot>         mSnapshot;
+    std::shared_ptr<abstract::IScalingStrategy> mStrategy;
 	  std::shared_ptr<ThreadPool> mThreadPool;
     itc::sys::Nap               mSleep;
     
+    /**
+     * @brief publishes the snapshot of the sampled mTPStats, the rates are
+     * derived from the previous sample.
+     **/
+    void publish()
+    {
+      tpsnapshot snapshot;
+      snapshot.pool=mTPStats;
+      snapshot.arrival=0;
+      snapshot.throughput=0;
+
+      if(mTPStats.timestamp > mLastStats.timestamp)
+      {
+        const double dt=double(mTPStats.timestamp-mLastStats.timestamp)/1e9;
+        snapshot.arrival=double(mTPStats.enqueued-mLastStats.enqueued)/dt;
+        snapshot.throughput=double(mTPStats.completed-mLastStats.completed)/dt;
+      }
+      mThreadPool.get()->getWaitHistogram(snapshot.wait);
+      mThreadPool.get()->getExecHistogram(snapshot.exec);
+
+      mSnapshot.write(snapshot);
+      mLastStats=mTPStats;
+    }
+
   public:
     explicit ThreadPoolManager(
       const size_t& maxthreads=200,
@@ -72,8 +108,10 @@ namespace itc
       const size_t& min_thr_ready=10
     ):mMutex(), doStart(false),doRun(true), canStop(true),
       mPurgeTm(purge_tm_usec),mMaxThreads(maxthreads),
-      mMinReadyThr(min_thr_ready),mOvercommitThreads(overcommit),
-      mThreadPool(std::make_shared<ThreadPool>(min_thr_ready,false,1))
+      mMinReadyThr(min_thr_ready),mOvercommitThreads(overcommit), mTPStats(),
+      mLastStats(), mSnapshot(),
+      mStrategy(std::make_shared<HeuristicScaling>(maxthreads, overcommit, min_thr_ready)),
+      mThreadPool(std::make_shared<ThreadPool>(min_thr_ready,false,1,ThreadPool::PULL))
     {
       ITCSyncLock dosync(mMutex);
       doStart=true;
@@ -83,16 +121,53 @@ namespace itc
       }
     }
     
+    /**
+     * @brief replaces the pool resizing policy, the strategy is evaluated
+     * every purge_tm_usec in the manager's thread.
+     **/
+    void setScalingStrategy(const std::shared_ptr<abstract::IScalingStrategy>& strategy)
+    {
+      if(!strategy)
+      {
+        throw std::logic_error("ThreadPoolManager::setScalingStrategy() - the strategy is empty");
+      }
+      ITCSyncLock dosync(mMutex);
+      mStrategy = strategy;
+    }
+    
     void enqueueRunnable(const abstract::IThreadPool::value_type& ref)
     {
       mThreadPool.get()->enqueue(ref);
     }
     
+    void enqueueRunnable(const abstract::IThreadPool::value_type& ref, const TaskPriority priority)
+    {
+      mThreadPool.get()->enqueue(ref, priority);
+    }
+    
+    void enqueueRunnable(
+      std::vector<abstract::IThreadPool::value_type>&& batch, 
+      const TaskPriority priority = NORMAL)
+    {
+      mThreadPool.get()->enqueue(std::move(batch), priority);
+    }
+    
+    template <typename InputIterator> void enqueueRunnable(
+      InputIterator first, InputIterator last, const TaskPriority priority = NORMAL)
+    {
+      mThreadPool.get()->enqueue(first, last, priority);
+    }
+    
     const size_t getQueueDepth()
     {
       return mThreadPool.get()->getTaskQueueDepth();
     }
     
+    const size_t getQueueDepth(const TaskPriority priority)
+    {
+      return mThreadPool.get()->getTaskQueueDepth(priority);
+    }
+    
     void execute()
     {
       while(doRun)
@@ -100,28 +175,22 @@ namespace itc
         canStop=false;
         mThreadPool.get()->shakePools();
 
-        mTPStats.tqdp=mThreadPool.get()->getTaskQueueDepth();
-        mTPStats.tc=mThreadPool.get()->getThreadsCount();
-        mTPStats.tpc=mThreadPool.get()->getPassiveThreadsCount();
-        mTPStats.tac=mThreadPool.get()->getActiveThreadsCount();
-        mTPStats.maxthreads=mThreadPool.get()->getMaxThreads();
-        mTPStats.overcommit=mThreadPool.get()->getOvercommitRatio();
+        mThreadPool.get()->getStats(mTPStats);
+        publish();
 
         try
         {
           ITCSyncLock dosync(mMutex);
     
-          if(mTPStats.tpc<mMinReadyThr)
-          {
-            if((mTPStats.tc<(mMaxThreads+mOvercommitThreads)) && (mTPStats.tqdp>(mTPStats.tc*1.25)))
-            {
-                mThreadPool.get()->expand(size_t(log2(mTPStats.maxthreads)));
-            }
-          }
+          const ptrdiff_t delta=mStrategy->evaluate(mTPStats);
 
-          if((mTPStats.tpc>mMinReadyThr)&&(mTPStats.tpc>=mTPStats.tac)&&((mTPStats.tqdp*2)<mTPStats.maxthreads))
+          if(delta > 0)
+          {
+            mThreadPool.get()->expand(size_t(delta));
+          }else
           {
-            if(mThreadPool.get()->getMaxThreads() > mMaxThreads)
+            // one by one, the pool never goes below its initial size
+            for(ptrdiff_t i=0;i>delta;--i)
             {
               mThreadPool.get()->reduce(1);
             }
@@ -135,13 +204,33 @@ namespace itc
       canStop=true;
     }
     
+    /**
+     * @brief logs the tasks which run threshold_ns or longer, every n-th of
+     * them, see ThreadPool::setSlowTaskLog().
+     **/
+    void setSlowTaskLog(const uint64_t threshold_ns, const uint64_t every = 1)
+    {
+      mThreadPool.get()->setSlowTaskLog(threshold_ns, every);
+    }
+    
+    /**
+     * @return the last published state of the pool, lock-free. The pull
+     * API for the metrics exporters.
+     **/
+    const tpsnapshot getSnapshot() const
+    {
+      return mSnapshot.read();
+    }
+
     void logStats()
     {
+      const tpsnapshot snapshot(getSnapshot());
       ::itc::getLog()->info(
       __FILE__,__LINE__,
-        "tc:%ju  pc:%ju  ac:%ju qd:%ju mt:%ju, mtl:%ju",
-        mTPStats.tc, mTPStats.tpc, mTPStats.tac, 
-        mTPStats.tqdp,mTPStats.maxthreads,mMaxThreads
+        "tc:%ju  pc:%ju  ac:%ju qd:%ju mt:%ju, mtl:%ju, tps:%.1f, wait p99:%juns, exec p99:%juns",
+        snapshot.pool.tc, snapshot.pool.tpc, snapshot.pool.tac, 
+        snapshot.pool.tqdp,snapshot.pool.maxthreads,mMaxThreads,
+        snapshot.throughput,snapshot.wait.percentile(0.99),snapshot.exec.percentile(0.99)
       );
     }
     
@@ -0,0 +1,110 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: TimerMap.h 1 2021-03-27 13:21:09Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __TIMERMAP_H__
+#  define __TIMERMAP_H__
+
+#include <cstddef>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <abstract/ITimerQueue.h>
+
+namespace itc
+{
+  /**
+   * @brief the timers ordered by deadline in std::multimap, O(log n)
+   * insert and expire, exact deadlines. The timers of equal deadline expire
+   * in the order of insertion. Cancel finds the timer by id in the hash
+   * table and erases it by iterator (amortized O(1)).
+   **/
+  template <typename T> class TimerMap : public abstract::ITimerQueue<T>
+  {
+   private:
+    typedef std::pair<uint64_t, T> entry_type;
+    typedef std::multimap<uint64_t, entry_type> map_type;
+    typedef std::unordered_map<uint64_t, typename map_type::iterator> index_type;
+
+    map_type    mSchedule;
+    index_type  mIndex;
+    uint64_t    mLastId;
+
+   public:
+    typedef T value_type;
+
+    explicit TimerMap() : mSchedule(), mIndex(), mLastId(0){}
+    TimerMap(const TimerMap&)=delete;
+    TimerMap(TimerMap&)=delete;
+
+    const uint64_t insert(const uint64_t deadline, const value_type& ref)
+    {
+      const uint64_t id=++mLastId;
+      mIndex.emplace(id, mSchedule.emplace(deadline, entry_type(id, ref)));
+      return id;
+    }
+
+    const bool cancel(const uint64_t id)
+    {
+      auto it=mIndex.find(id);
+      if(it == mIndex.end())
+      {
+        return false;
+      }
+      mSchedule.erase(it->second);
+      mIndex.erase(it);
+      return true;
+    }
+
+    const size_t expire(const uint64_t now, std::vector<value_type>& out)
+    {
+      size_t count=0;
+      while((!mSchedule.empty())&&(mSchedule.begin()->first <= now))
+      {
+        auto it=mSchedule.begin();
+        mIndex.erase(it->second.first);
+        out.push_back(std::move(it->second.second));
+        mSchedule.erase(it);
+        ++count;
+      }
+      return count;
+    }
+
+    const bool getNextDeadline(uint64_t& deadline)
+    {
+      if(mSchedule.empty())
+      {
+        return false;
+      }
+      deadline=mSchedule.begin()->first;
+      return true;
+    }
+
+    const size_t size() const
+    {
+      return mSchedule.size();
+    }
+
+    const bool empty() const
+    {
+      return mSchedule.empty();
+    }
+
+    void clear()
+    {
+      mSchedule.clear();
+      mIndex.clear();
+    }
+  };
+}
+
+#endif /* __TIMERMAP_H__ */
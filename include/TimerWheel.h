@@ -0,0 +1,390 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: TimerWheel.h 1 2021-03-27 14:02:37Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __TIMERWHEEL_H__
+#  define __TIMERWHEEL_H__
+
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <abstract/ITimerQueue.h>
+
+namespace itc
+{
+  /**
+   * @brief hierarchical timing wheel (Varghese and Lauck). The deadlines
+   * are rounded up to the ticks, the timer expiring within 64 ticks sits
+   * in the level 0 slot of its tick, the later ones sit in the coarser
+   * levels (64 times coarser each) and cascade down as the time comes
+   * closer. Beyond 64^5 ticks the timers wait in the overflow list.
+   *
+   * Insert and cancel are O(1) and allocation free after the warm-up (the
+   * nodes are recycled), expire is O(1) per tick plus O(1) per expired or
+   * cascaded timer. The empty ticks are skipped with the occupancy bitmaps.
+   *
+   * The timer id is the index of its node and the generation of the node,
+   * which is bumped on every recycle, so the stale ids are refused.
+   *
+   * The timer fires at the first expire() at or after its deadline, but
+   * not earlier than the end of its tick.
+   **/
+  template <typename T> class TimerWheel : public abstract::ITimerQueue<T>
+  {
+   public:
+    typedef T value_type;
+
+   private:
+    static constexpr size_t   SLOT_BITS = 6;
+    static constexpr size_t   SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr size_t   LEVELS = 5;
+    static constexpr size_t   DUE_LIST = LEVELS;
+    static constexpr size_t   OVERFLOW_LIST = LEVELS + 1;
+
+    struct Node
+    {
+      Node*       next;
+      Node**      pprev;
+      uint64_t    expires;
+      size_t      level;
+      size_t      slot;
+      uint32_t    index;
+      uint32_t    generation;
+      value_type  data;
+
+      explicit Node(const uint32_t idx)
+      : next(nullptr), pprev(nullptr), expires(0), level(0), slot(0),
+        index(idx), generation(1), data(){}
+
+      const uint64_t id() const
+      {
+        return (uint64_t(index) << 32) | generation;
+      }
+    };
+
+    const uint64_t  mTick;
+    uint64_t        mCurrent;
+    size_t          mSize;
+    Node*           mSlots[LEVELS][SLOTS];
+    uint64_t        mOccupied[LEVELS];
+    Node*           mDue;
+    Node*           mOverflow;
+    Node*           mFree;
+    std::vector<Node*> mNodes;
+
+    static const size_t shift(const size_t level)
+    {
+      return level * SLOT_BITS;
+    }
+
+    Node*& head(const size_t level, const size_t slot)
+    {
+      if(level == DUE_LIST) return mDue;
+      if(level == OVERFLOW_LIST) return mOverflow;
+      return mSlots[level][slot];
+    }
+
+    void link(Node* node, const size_t level, const size_t slot)
+    {
+      Node*& first=head(level, slot);
+
+      node->level=level;
+      node->slot=slot;
+      node->next=first;
+      if(first != nullptr) first->pprev=&node->next;
+      first=node;
+      node->pprev=&first;
+
+      if(level < LEVELS) mOccupied[level] |= (uint64_t(1) << slot);
+    }
+
+    void unlink(Node* node)
+    {
+      *(node->pprev)=node->next;
+      if(node->next != nullptr) node->next->pprev=node->pprev;
+
+      if((node->level < LEVELS)&&(mSlots[node->level][node->slot] == nullptr))
+      {
+        mOccupied[node->level] &= ~(uint64_t(1) << node->slot);
+      }
+      node->next=nullptr;
+      node->pprev=nullptr;
+    }
+
+    /**
+     * @brief puts the node to the level by its distance from the current
+     * tick, and to the slot by its expiration tick.
+     **/
+    void place(Node* node)
+    {
+      if(node->expires <= mCurrent)
+      {
+        link(node, DUE_LIST, 0);
+        return;
+      }
+
+      const uint64_t delta=node->expires - mCurrent;
+
+      for(size_t level=0;level<LEVELS;++level)
+      {
+        if(delta < (uint64_t(1) << shift(level + 1)))
+        {
+          link(node, level, (node->expires >> shift(level)) & SLOT_MASK);
+          return;
+        }
+      }
+      link(node, OVERFLOW_LIST, 0);
+    }
+
+    Node* allocate()
+    {
+      if(mFree != nullptr)
+      {
+        Node* node=mFree;
+        mFree=node->next;
+        node->next=nullptr;
+        return node;
+      }
+      Node* node=new Node(uint32_t(mNodes.size()));
+      mNodes.push_back(node);
+      return node;
+    }
+
+    void recycle(Node* node)
+    {
+      node->data=value_type();
+      if(++(node->generation) == 0) node->generation=1;
+      node->pprev=nullptr;
+      node->next=mFree;
+      mFree=node;
+    }
+
+    /**
+     * @brief moves all nodes of the list out and re-places them.
+     **/
+    void cascade(const size_t level, const size_t slot)
+    {
+      Node* node=head(level, slot);
+      head(level, slot)=nullptr;
+      if(level < LEVELS) mOccupied[level] &= ~(uint64_t(1) << slot);
+
+      while(node != nullptr)
+      {
+        Node* next=node->next;
+        place(node);
+        node=next;
+      }
+    }
+
+    const size_t collect(Node*& first, std::vector<value_type>& out)
+    {
+      size_t count=0;
+      Node* node=first;
+      first=nullptr;
+
+      while(node != nullptr)
+      {
+        Node* next=node->next;
+        out.push_back(std::move(node->data));
+        recycle(node);
+        node=next;
+        ++count;
+      }
+      mSize-=count;
+      return count;
+    }
+
+    /**
+     * @return the distance (1..64) from the slot to the next occupied slot
+     * of the level going forward, 0 if the level is empty.
+     **/
+    const uint64_t distance(const size_t level, const size_t slot) const
+    {
+      const uint64_t bits=mOccupied[level];
+      if(bits == 0) return 0;
+
+      const size_t start=(slot + 1) & SLOT_MASK;
+      const uint64_t rotated=(start == 0) ? bits : ((bits >> start) | (bits << (SLOTS - start)));
+      return uint64_t(__builtin_ctzll(rotated)) + 1;
+    }
+
+    /**
+     * @return the earliest tick after mCurrent, at which a slot is expired
+     * or cascaded (a lower bound of the next expiration).
+     **/
+    const uint64_t nextEvent() const
+    {
+      uint64_t result=std::numeric_limits<uint64_t>::max();
+
+      for(size_t level=0;level<LEVELS;++level)
+      {
+        const uint64_t base=mCurrent >> shift(level);
+        const uint64_t dist=distance(level, base & SLOT_MASK);
+        if(dist > 0)
+        {
+          result=std::min(result, (base + dist) << shift(level));
+        }
+      }
+      if(mOverflow != nullptr)
+      {
+        result=std::min(result, ((mCurrent >> shift(LEVELS)) + 1) << shift(LEVELS));
+      }
+      return result;
+    }
+
+    /**
+     * @brief advances the wheel by one tick.
+     **/
+    void step(std::vector<value_type>& out, size_t& count)
+    {
+      ++mCurrent;
+
+      if((mCurrent & ((uint64_t(1) << shift(LEVELS)) - 1)) == 0)
+      {
+        cascade(OVERFLOW_LIST, 0);
+      }
+      for(size_t level=LEVELS-1;level>0;--level)
+      {
+        if((mCurrent & ((uint64_t(1) << shift(level)) - 1)) == 0)
+        {
+          cascade(level, (mCurrent >> shift(level)) & SLOT_MASK);
+        }
+      }
+      count+=collect(mSlots[0][mCurrent & SLOT_MASK], out);
+      mOccupied[0] &= ~(uint64_t(1) << (mCurrent & SLOT_MASK));
+      count+=collect(mDue, out);
+    }
+
+   public:
+    /**
+     * @param tick - resolution of the wheel in the scheduler's time units
+     * @param now - current time in the scheduler's time units
+     **/
+    explicit TimerWheel(const uint64_t tick, const uint64_t now = 0)
+    : mTick(std::max(uint64_t(1), tick)), mCurrent(now / mTick), mSize(0),
+      mDue(nullptr), mOverflow(nullptr), mFree(nullptr), mNodes()
+    {
+      for(size_t level=0;level<LEVELS;++level)
+      {
+        mOccupied[level]=0;
+        for(size_t slot=0;slot<SLOTS;++slot)
+        {
+          mSlots[level][slot]=nullptr;
+        }
+      }
+    }
+
+    TimerWheel(const TimerWheel&)=delete;
+    TimerWheel(TimerWheel&)=delete;
+
+    ~TimerWheel()
+    {
+      clear();
+      for(Node* node : mNodes)
+      {
+        delete node;
+      }
+    }
+
+    const uint64_t insert(const uint64_t deadline, const value_type& ref)
+    {
+      Node* node=allocate();
+      node->data=ref;
+      node->expires=(deadline / mTick) + ((deadline % mTick) ? 1 : 0);
+      place(node);
+      ++mSize;
+      return node->id();
+    }
+
+    const bool cancel(const uint64_t id)
+    {
+      const size_t index=size_t(id >> 32);
+      if(index >= mNodes.size())
+      {
+        return false;
+      }
+
+      Node* node=mNodes[index];
+      if((node->generation != uint32_t(id))||(node->pprev == nullptr))
+      {
+        return false;
+      }
+      unlink(node);
+      recycle(node);
+      --mSize;
+      return true;
+    }
+
+    const size_t expire(const uint64_t now, std::vector<value_type>& out)
+    {
+      const uint64_t target=now / mTick;
+      size_t count=collect(mDue, out);
+
+      while(mCurrent < target)
+      {
+        if(mSize == 0)
+        {
+          mCurrent=target;
+          break;
+        }
+
+        const uint64_t next=nextEvent();
+        if(next > target)
+        {
+          mCurrent=target;
+          break;
+        }
+        mCurrent=next - 1;
+        step(out, count);
+      }
+      return count;
+    }
+
+    const bool getNextDeadline(uint64_t& deadline)
+    {
+      if(mSize == 0)
+      {
+        return false;
+      }
+      deadline=((mDue != nullptr) ? mCurrent : nextEvent()) * mTick;
+      return true;
+    }
+
+    const size_t size() const
+    {
+      return mSize;
+    }
+
+    const bool empty() const
+    {
+      return mSize == 0;
+    }
+
+    void clear()
+    {
+      std::vector<value_type> drop;
+      collect(mDue, drop);
+      collect(mOverflow, drop);
+      for(size_t level=0;level<LEVELS;++level)
+      {
+        for(size_t slot=0;slot<SLOTS;++slot)
+        {
+          collect(mSlots[level][slot], drop);
+        }
+        mOccupied[level]=0;
+      }
+    }
+  };
+}
+
+#endif /* __TIMERWHEEL_H__ */
@@ -0,0 +1,786 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: WorkStealingThreadPool.h 1 2021-03-02 20:14:12Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __WORKSTEALINGTHREADPOOL_H__
+#  define __WORKSTEALINGTHREADPOOL_H__
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <abstract/Runnable.h>
+#include <abstract/IThreadPool.h>
+#include <TSLog.h>
+
+namespace itc
+{
+  /**
+   * @brief work-stealing implementation of the abstract::IThreadPool.
+   * Every worker owns a lock-free Chase-Lev deque. The worker pushes and pops
+   * its own tasks at the bottom of the deque (LIFO), while idle workers steal
+   * from the top of the victims deques (FIFO). Runnables enqueued by threads
+   * outside of the pool are pushed into the lock-free inboxes of the workers
+   * in round-robin order, so enqueue() never takes a lock unless there are
+   * parked workers to wake up.
+   *
+   * The workers are std::threads, they are created on construction and on
+   * expand() or autotune. The idle workers above getMaxThreads() (after
+   * reduce() or autotune overcommit) are retired, the last one first. A
+   * retired worker keeps its slot and its deque, so the tasks pushed to it
+   * meanwhile are stolen by the others, and it is restarted when the pool
+   * grows again.
+   *
+   * The slots are allocated once, the limit defaults to maxthreads times
+   * overcommit. expand() past the limit is clamped to it.
+   **/
+  class WorkStealingThreadPool : public abstract::IThreadPool
+  {
+   private:
+    struct TaskNode
+    {
+      value_type task;
+      TaskNode*  next;
+      explicit TaskNode(const value_type& ref) : task(ref), next(nullptr){}
+    };
+
+    /**
+     * @brief Chase-Lev deque (Le, Pop, Cohen, Nardelli: "Correct and
+     * Efficient Work-Stealing for Weak Memory Models"). push() and pop() may
+     * be called by the owner only, steal() by any thread. The retired
+     * buffers are kept until the deque is destroyed, because the thieves
+     * may still read them.
+     **/
+    class TaskDeque
+    {
+     private:
+      struct Buffer
+      {
+        const int64_t                          capacity;
+        std::unique_ptr<std::atomic<TaskNode*>[]> cells;
+
+        explicit Buffer(const int64_t cap)
+        : capacity(cap), cells(new std::atomic<TaskNode*>[cap]){}
+
+        TaskNode* get(const int64_t idx) const
+        {
+          return cells[idx & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(const int64_t idx, TaskNode* node)
+        {
+          cells[idx & (capacity - 1)].store(node, std::memory_order_relaxed);
+        }
+      };
+
+      std::atomic<int64_t>                 mTop;
+      std::atomic<int64_t>                 mBottom;
+      std::atomic<Buffer*>                 mBuffer;
+      std::vector<std::unique_ptr<Buffer>> mBuffers;
+
+      Buffer* grow(Buffer* old, const int64_t bottom, const int64_t top)
+      {
+        mBuffers.emplace_back(new Buffer(old->capacity * 2));
+        Buffer* buffer = mBuffers.back().get();
+        for(int64_t i = top; i < bottom; ++i)
+        {
+          buffer->put(i, old->get(i));
+        }
+        mBuffer.store(buffer, std::memory_order_release);
+        return buffer;
+      }
+
+     public:
+      explicit TaskDeque(const int64_t capacity = 256)
+      : mTop{0}, mBottom{0}, mBuffer{nullptr}, mBuffers()
+      {
+        mBuffers.emplace_back(new Buffer(capacity));
+        mBuffer.store(mBuffers.back().get());
+      }
+
+      TaskDeque(const TaskDeque&) = delete;
+      TaskDeque(TaskDeque&) = delete;
+
+      void push(TaskNode* node)
+      {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed);
+        const int64_t top = mTop.load(std::memory_order_acquire);
+        Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+
+        if(bottom - top > buffer->capacity - 1)
+        {
+          buffer = grow(buffer, bottom, top);
+        }
+        buffer->put(bottom, node);
+        std::atomic_thread_fence(std::memory_order_release);
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+      }
+
+      TaskNode* pop()
+      {
+        const int64_t bottom = mBottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+        mBottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = mTop.load(std::memory_order_relaxed);
+
+        if(top <= bottom)
+        {
+          TaskNode* node = buffer->get(bottom);
+          if(top == bottom)
+          {
+            // the last element, competing with thieves
+            if(!mTop.compare_exchange_strong(
+              top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+              node = nullptr;
+            }
+            mBottom.store(bottom + 1, std::memory_order_relaxed);
+          }
+          return node;
+        }
+        mBottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      TaskNode* steal()
+      {
+        int64_t top = mTop.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = mBottom.load(std::memory_order_acquire);
+
+        if(top < bottom)
+        {
+          TaskNode* node = mBuffer.load(std::memory_order_acquire)->get(top);
+          if(mTop.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+          {
+            return node;
+          }
+        }
+        return nullptr;
+      }
+
+      ~TaskDeque()
+      {
+        TaskNode* node;
+        while((node = pop()) != nullptr)
+        {
+          delete node;
+        }
+      }
+    };
+
+    /**
+     * @brief multi-producer lock-free inbox (Treiber stack). Consumers take
+     * the whole content at once, so there is no ABA problem.
+     **/
+    class Inbox
+    {
+     private:
+      std::atomic<TaskNode*> mHead;
+
+     public:
+      explicit Inbox() : mHead{nullptr}{}
+      Inbox(const Inbox&) = delete;
+      Inbox(Inbox&) = delete;
+
+      void push(TaskNode* node)
+      {
+        push(node, node);
+      }
+
+      /**
+       * @brief pushes the chain of nodes linked from first to last with
+       * a single CAS (if uncontended).
+       **/
+      void push(TaskNode* first, TaskNode* last)
+      {
+        last->next = mHead.load(std::memory_order_relaxed);
+        while(!mHead.compare_exchange_weak(
+          last->next, first, std::memory_order_release, std::memory_order_relaxed));
+      }
+
+      /**
+       * @return the list of nodes, the most recently pushed node first.
+       **/
+      TaskNode* takeAll()
+      {
+        if(mHead.load(std::memory_order_relaxed) == nullptr)
+        {
+          return nullptr;
+        }
+        return mHead.exchange(nullptr, std::memory_order_acquire);
+      }
+
+      ~Inbox()
+      {
+        TaskNode* node = takeAll();
+        while(node != nullptr)
+        {
+          TaskNode* next = node->next;
+          delete node;
+          node = next;
+        }
+      }
+    };
+
+    struct Worker
+    {
+      const size_t  mId;
+      TaskDeque     mDeque;
+      Inbox         mInbox;
+      uint64_t      mSeed;
+      std::thread   mThread;
+
+      explicit Worker(const size_t id)
+      : mId(id), mDeque(), mInbox(), mSeed(id * 0x9E3779B97F4A7C15ULL + 1), mThread(){}
+    };
+
+    const size_t                            mLimit;
+    std::unique_ptr<std::atomic<Worker*>[]> mWorkers;
+    std::atomic<size_t>                     mSlots; // created workers, running or retired
+    std::atomic<size_t>                     mWorkersCount; // running workers
+    std::atomic<size_t>                     mMaxThreads;
+    std::atomic<size_t>                     mMinThreads;
+    std::atomic<bool>                       mAutotune;
+    std::atomic<float>                      mOvercommitRatio;
+    std::atomic<bool>                       doRun;
+    std::atomic<int64_t>                    mPending;
+    std::atomic<size_t>                     mSleepers;
+    std::mutex                              mSpawnMutex;
+    std::mutex                              mStopMutex;
+    std::mutex                              mParkMutex;
+    std::condition_variable                 mParkEvent;
+
+    static const size_t slotsFor(const size_t maxthreads, const float overcommit, const size_t limit)
+    {
+      if(limit > 0)
+      {
+        return std::max(limit, maxthreads);
+      }
+      return std::max(maxthreads, size_t(std::ceil(double(maxthreads) * double(overcommit))));
+    }
+
+    static Worker*& currentWorker()
+    {
+      static thread_local Worker* worker = nullptr;
+      return worker;
+    }
+
+    static WorkStealingThreadPool*& currentPool()
+    {
+      static thread_local WorkStealingThreadPool* pool = nullptr;
+      return pool;
+    }
+
+    /**
+     * @brief set on a worker thread which has stopped its own pool, the
+     * thread is detached and frees its Worker itself.
+     **/
+    static bool& orphaned()
+    {
+      static thread_local bool detached = false;
+      return detached;
+    }
+
+    static size_t& roundRobin()
+    {
+      static thread_local size_t next = 0;
+      return next;
+    }
+
+    /**
+     * @brief spawns the workers up to the limit. Must be called with
+     * mSpawnMutex locked.
+     **/
+    void spawnThreads(const size_t limit)
+    {
+      size_t count = mWorkersCount.load();
+      const size_t max = std::min(limit, mLimit);
+
+      while(doRun && (count < max))
+      {
+        Worker* worker = mWorkers[count].load(std::memory_order_relaxed);
+        if(worker == nullptr)
+        {
+          worker = new Worker(count);
+          mWorkers[count].store(worker, std::memory_order_release);
+          mSlots.store(count + 1, std::memory_order_release);
+        }else if(worker->mThread.joinable())
+        {
+          // retired, its thread has left run() or is about to
+          worker->mThread.join();
+        }
+        mWorkersCount.store(++count, std::memory_order_release);
+        worker->mThread = std::thread([this, worker](){ run(worker); });
+      }
+    }
+
+    /**
+     * @return true if the worker is the last running one and the pool has
+     * more workers than getMaxThreads().
+     **/
+    const bool surplus(const Worker* worker) const
+    {
+      const size_t count = mWorkersCount.load();
+      return (count > mMaxThreads) && (worker->mId + 1 == count);
+    }
+
+    /**
+     * @brief retires the idle worker if it is a surplus.
+     * @return true if the worker must leave run().
+     **/
+    const bool retire(Worker* worker)
+    {
+      {
+        std::lock_guard<std::mutex> sync(mSpawnMutex);
+        if((!doRun) || (!surplus(worker)))
+        {
+          return false;
+        }
+        mWorkersCount.store(worker->mId, std::memory_order_release);
+      }
+      // the next worker may be a surplus as well
+      std::lock_guard<std::mutex> sync(mParkMutex);
+      mParkEvent.notify_all();
+      return true;
+    }
+
+    /**
+     * @brief wakes up a parked worker if any.
+     **/
+    void signal(const size_t tasks)
+    {
+      mPending.fetch_add(tasks);
+
+      if(mSleepers.load() > 0)
+      {
+        std::lock_guard<std::mutex> sync(mParkMutex);
+        if(tasks > 1)
+        {
+          mParkEvent.notify_all();
+        }else
+        {
+          mParkEvent.notify_one();
+        }
+      }else if(mAutotune)
+      {
+        const size_t absMax = (size_t) (mMaxThreads * mOvercommitRatio);
+        if((size_t(std::max(mPending.load(), int64_t(0))) > mWorkersCount.load())&&(mWorkersCount.load() < absMax))
+        {
+          std::lock_guard<std::mutex> sync(mSpawnMutex);
+          spawnThreads(mWorkersCount.load() + 1);
+        }
+      }
+    }
+
+    static uint64_t nextRandom(Worker* worker)
+    {
+      worker->mSeed ^= worker->mSeed << 13;
+      worker->mSeed ^= worker->mSeed >> 7;
+      worker->mSeed ^= worker->mSeed << 17;
+      return worker->mSeed;
+    }
+
+    /**
+     * @brief moves the content of an inbox into the worker's deque. The
+     * newest node is pushed first, so the owner's LIFO pop() runs the
+     * externally enqueued tasks in the order of arrival.
+     **/
+    static TaskNode* drain(Inbox& inbox, Worker* worker)
+    {
+      TaskNode* node = inbox.takeAll();
+      while(node != nullptr)
+      {
+        TaskNode* next = node->next;
+        worker->mDeque.push(node);
+        node = next;
+      }
+      return worker->mDeque.pop();
+    }
+
+    /**
+     * @brief the retired workers are victims too, the producers may have
+     * pushed to their inboxes before they were retired.
+     **/
+    TaskNode* steal(Worker* thief)
+    {
+      const size_t count = mSlots.load(std::memory_order_acquire);
+      const size_t start = nextRandom(thief) % count;
+
+      for(size_t i = 0; i < count; ++i)
+      {
+        Worker* victim = mWorkers[(start + i) % count].load(std::memory_order_acquire);
+
+        if(victim != thief)
+        {
+          TaskNode* node = victim->mDeque.steal();
+          if(node == nullptr)
+          {
+            node = drain(victim->mInbox, thief);
+          }
+          if(node != nullptr)
+          {
+            return node;
+          }
+        }
+      }
+      return nullptr;
+    }
+
+    TaskNode* next(Worker* worker)
+    {
+      TaskNode* node = worker->mDeque.pop();
+
+      if(node == nullptr)
+      {
+        node = drain(worker->mInbox, worker);
+      }
+      if(node == nullptr)
+      {
+        node = steal(worker);
+      }
+      if(node != nullptr)
+      {
+        mPending.fetch_sub(1);
+      }
+      return node;
+    }
+
+    void park(const Worker* worker)
+    {
+      std::unique_lock<std::mutex> sync(mParkMutex);
+      mSleepers.fetch_add(1);
+      mParkEvent.wait(sync, [this, worker](){ return (mPending.load() > 0) || (!doRun) || surplus(worker); });
+      mSleepers.fetch_sub(1);
+    }
+
+    void run(Worker* worker)
+    {
+      currentWorker() = worker;
+      currentPool() = this;
+
+      while(doRun)
+      {
+        TaskNode* node = next(worker);
+
+        for(size_t spin = 0; (node == nullptr) && (spin < 64) && doRun; ++spin)
+        {
+          std::this_thread::yield();
+          node = next(worker);
+        }
+
+        if(node != nullptr)
+        {
+          value_type task(std::move(node->task));
+          delete node;
+          try
+          {
+            task->execute();
+          }catch(const std::exception& e)
+          {
+            ::itc::getLog()->error(
+              __FILE__, __LINE__,
+              "WorkStealingThreadPool::run() - the Runnable has thrown an exception: %s",
+              e.what()
+            );
+          }catch(...)
+          {
+            ::itc::getLog()->error(
+              __FILE__, __LINE__,
+              "WorkStealingThreadPool::run() - the Runnable has thrown an unknown exception"
+            );
+          }
+          task.reset();
+          if(orphaned())
+          {
+            // the task has stopped (maybe destroyed) the pool, this must
+            // not be touched any more
+            delete worker;
+            return;
+          }
+        }else if(retire(worker))
+        {
+          return;
+        }else
+        {
+          park(worker);
+        }
+      }
+    }
+
+   public:
+    /**
+     * @param limit - the most workers the pool may ever run, 0 for
+     * maxthreads * overcommit.
+     **/
+    explicit WorkStealingThreadPool(
+      const size_t maxthreads = 10, bool autotune = true, float overcommit = 1.2,
+      const size_t limit = 0
+      ) : mLimit(slotsFor(maxthreads, overcommit, limit)), mWorkers(new std::atomic<Worker*>[mLimit]),
+      mSlots{0}, mWorkersCount{0},
+      mMaxThreads(maxthreads), mMinThreads(maxthreads), mAutotune(autotune),
+      mOvercommitRatio(overcommit), doRun(true), mPending{0}, mSleepers{0}
+    {
+      if(maxthreads == 0)
+      {
+        throw std::logic_error("WorkStealingThreadPool requires at least one worker");
+      }
+      for(size_t i = 0; i < mLimit; ++i)
+      {
+        mWorkers[i].store(nullptr, std::memory_order_relaxed);
+      }
+      ::itc::getLog()->debug(
+        __FILE__, __LINE__,
+        "created WorkStealingThreadPool::WorkStealingThreadPool(%ju,%u,%f,%ju)",
+        size_t(mMaxThreads), bool(mAutotune), float(mOvercommitRatio), mLimit
+        );
+      std::lock_guard<std::mutex> sync(mSpawnMutex);
+      spawnThreads(mMaxThreads);
+    }
+
+    WorkStealingThreadPool(const WorkStealingThreadPool&) = delete;
+    WorkStealingThreadPool(WorkStealingThreadPool&) = delete;
+
+    const bool getAutotune() const
+    {
+      return mAutotune;
+    }
+
+    void setAutotune(const bool& autotune)
+    {
+      mAutotune = autotune;
+    }
+
+    const size_t getMaxThreads() const
+    {
+      return mMaxThreads;
+    }
+
+    /**
+     * @return the most workers the pool may run.
+     **/
+    const size_t getThreadsLimit() const
+    {
+      return mLimit;
+    }
+
+    const float getOvercommitRatio() const
+    {
+      return mOvercommitRatio;
+    }
+
+    const size_t getThreadsCount() const
+    {
+      return mWorkersCount.load();
+    }
+
+    const size_t getFreeThreadsCount() const
+    {
+      return mSleepers.load();
+    }
+
+    const size_t getTaskQueueDepth() const
+    {
+      return size_t(std::max(mPending.load(), int64_t(0)));
+    }
+
+    const bool mayRun() const
+    {
+      return doRun;
+    }
+
+    void expand(const size_t& inc)
+    {
+      std::lock_guard<std::mutex> sync(mSpawnMutex);
+      if(mayRun())
+      {
+        if(mMaxThreads + inc > mLimit)
+        {
+          ::itc::getLog()->error(
+            __FILE__, __LINE__,
+            "WorkStealingThreadPool::expand() - %ju more workers exceed the limit of %ju, clamped",
+            inc, mLimit
+          );
+        }
+        mMaxThreads = std::min(mMaxThreads + inc, mLimit);
+        spawnThreads(mMaxThreads);
+      }
+    }
+
+    /**
+     * @brief lowers the workers limit, the idle workers above it retire.
+     **/
+    void reduce(const size_t& dec)
+    {
+      {
+        std::lock_guard<std::mutex> sync(mSpawnMutex);
+        if(mMaxThreads > mMinThreads)
+        {
+          mMaxThreads -= std::min(dec, mMaxThreads - mMinThreads);
+        }
+      }
+      std::lock_guard<std::mutex> sync(mParkMutex);
+      mParkEvent.notify_all();
+    }
+
+    /**
+     * @brief enqueues the Runnable. If called from a worker of this pool,
+     * the Runnable is pushed to the bottom of the worker's own deque,
+     * otherwise into the inbox of the next worker in round-robin order.
+     **/
+    void enqueue(const value_type& ref)
+    {
+      if(mayRun())
+      {
+        TaskNode* node = new TaskNode(ref);
+
+        if(currentPool() == this)
+        {
+          currentWorker()->mDeque.push(node);
+        }else
+        {
+          const size_t count = mWorkersCount.load(std::memory_order_acquire);
+          mWorkers[roundRobin()++ % count].load(std::memory_order_acquire)->mInbox.push(node);
+        }
+        signal(1);
+      }
+    }
+
+    /**
+     * @brief enqueues a batch of Runnables. From a worker of this pool the
+     * batch goes to the worker's own deque, otherwise it is split into
+     * chains, one per worker, and each chain is pushed into the worker's 
+     * inbox with a single CAS.
+     **/
+    template <typename InputIterator> void enqueue(InputIterator first, InputIterator last)
+    {
+      if(mayRun())
+      {
+        size_t count = 0;
+
+        if(currentPool() == this)
+        {
+          for(; first != last; ++first, ++count)
+          {
+            currentWorker()->mDeque.push(new TaskNode(*first));
+          }
+        }else
+        {
+          const size_t workers = mWorkersCount.load(std::memory_order_acquire);
+          std::vector<std::pair<TaskNode*, TaskNode*>> chains(workers, std::make_pair(nullptr, nullptr));
+
+          for(; first != last; ++first, ++count)
+          {
+            auto& chain = chains[count % workers];
+            TaskNode* node = new TaskNode(*first);
+            if(chain.first == nullptr)
+            {
+              chain.second = node;
+            }
+            node->next = chain.first;
+            chain.first = node;
+          }
+
+          const size_t start = roundRobin();
+          for(size_t i = 0; i < workers; ++i)
+          {
+            auto& chain = chains[i];
+            if(chain.first != nullptr)
+            {
+              mWorkers[(start + i) % workers].load(std::memory_order_acquire)->mInbox.push(chain.first, chain.second);
+            }
+          }
+          roundRobin() += count;
+        }
+        if(count > 0)
+        {
+          signal(count);
+        }
+      }
+    }
+
+    void enqueue(std::vector<value_type>&& batch)
+    {
+      enqueue(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+      batch.clear();
+    }
+
+    /**
+     * @brief stops and joins the workers. Called from a worker of this
+     * pool (e.g. its task drops the last reference to the pool) that
+     * worker's thread is detached instead, it frees its own Worker when
+     * the task returns.
+     **/
+    void stopPool()
+    {
+      {
+        std::lock_guard<std::mutex> sync(mParkMutex);
+        doRun = false;
+        mParkEvent.notify_all();
+      }
+
+      // joins without mSpawnMutex, an idle worker takes it in retire()
+      std::lock_guard<std::mutex> sync(mStopMutex);
+      size_t count = 0;
+      {
+        std::lock_guard<std::mutex> spawn(mSpawnMutex);
+        count = mSlots.load();
+      }
+      size_t self = count;
+
+      for(size_t i = 0; i < count; ++i)
+      {
+        Worker* worker = mWorkers[i].load();
+        if((worker != nullptr)&&(worker->mThread.joinable()))
+        {
+          if(worker->mThread.get_id() == std::this_thread::get_id())
+          {
+            worker->mThread.detach();
+            orphaned() = true;
+            self = i;
+          }else
+          {
+            worker->mThread.join();
+          }
+        }
+      }
+      // the others are joined, none can steal from it any more
+      if(self < count)
+      {
+        mWorkers[self].store(nullptr);
+      }
+    }
+
+    ~WorkStealingThreadPool() noexcept
+    {
+      stopPool();
+      const size_t count = mSlots.load();
+      for(size_t i = 0; i < count; ++i)
+      {
+        delete mWorkers[i].load();
+        mWorkers[i].store(nullptr);
+      }
+    }
+  };
+}
+
+#endif /* __WORKSTEALINGTHREADPOOL_H__ */
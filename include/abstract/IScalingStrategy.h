@@ -0,0 +1,40 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: IScalingStrategy.h 1 2021-04-02 11:17:52Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __ISCALINGSTRATEGY_H__
+#    define __ISCALINGSTRATEGY_H__
+
+#include <cstddef>
+#include <PoolMetrics.h>
+
+namespace itc
+{
+    namespace abstract
+    {
+        /**
+         * @brief decides how the ThreadPoolManager resizes the pool. It is
+         * called with every sample of the pool's state, in the manager's
+         * thread only.
+         */
+        class IScalingStrategy
+        {
+        public:
+            /**
+             * @return amount of the threads to add (> 0) or to remove (< 0).
+             **/
+            virtual const ptrdiff_t evaluate(const tpstats& stats) = 0;
+
+            virtual ~IScalingStrategy()=default;
+        };
+    }
+}
+#endif /*__ISCALINGSTRATEGY_H__*/
@@ -14,6 +14,7 @@
 #    define __ITHREADPOOL_H__
 
 #include <memory>
+#include <vector>
 namespace itc
 {
     namespace abstract
@@ -34,6 +35,7 @@ namespace itc
             virtual void expand(const size_t&) = 0;
             virtual void reduce(const size_t&) = 0;
             virtual void enqueue(const value_type&) = 0;
+            virtual void enqueue(std::vector<value_type>&&) = 0;
             
         protected:
             virtual ~IThreadPool()=default;
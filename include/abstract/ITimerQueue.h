@@ -0,0 +1,65 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: ITimerQueue.h 1 2021-03-27 13:08:44Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __ITIMERQUEUE_H__
+#    define __ITIMERQUEUE_H__
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace itc
+{
+    namespace abstract
+    {
+        /**
+         * @brief storage of the timers for the scheduler. The deadlines are
+         * plain integers in the scheduler's time units. Implementations are
+         * not thread safe, the scheduler serializes the access.
+         */
+        template <typename T> class ITimerQueue
+        {
+        public:
+            typedef T value_type;
+
+            /**
+             * @return id of the timer for cancel(), never 0.
+             **/
+            virtual const uint64_t insert(const uint64_t deadline, const value_type&) = 0;
+
+            /**
+             * @brief removes the pending timer.
+             * @return false if the timer is already expired or cancelled.
+             **/
+            virtual const bool cancel(const uint64_t id) = 0;
+
+            /**
+             * @brief appends all the timers with deadline <= now to out.
+             * @return amount of expired timers.
+             **/
+            virtual const size_t expire(const uint64_t now, std::vector<value_type>& out) = 0;
+
+            /**
+             * @brief the earliest deadline or a lower bound of it.
+             * @return false if there are no timers.
+             **/
+            virtual const bool getNextDeadline(uint64_t& deadline) = 0;
+
+            virtual const size_t size() const = 0;
+            virtual const bool empty() const = 0;
+            virtual void clear() = 0;
+
+            virtual ~ITimerQueue()=default;
+        };
+    }
+}
+#endif /*__ITIMERQUEUE_H__*/
@@ -1,12 +1,12 @@
 /**
  *  Copyright 2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
- * 
+ *
  * Distributed under the Boost Software License, Version 1.0.
  * (See accompanying file LICENSE_1_0.txt or copy at
  *          http://www.boost.org/LICENSE_1_0.txt)
- * 
+ *
  *  $Id: cfifo.h October 31, 2018 9:48 PM $
- * 
+ *
  **/
 
 #ifndef __CFIFO_H__
@@ -15,145 +15,564 @@
 #include <vector>
 #include <queue>
 #include <map>
+#include <new>
+#include <iterator>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
 #include <type_traits>
 #include <system_error>
+#include <EventCount.h>
 
 namespace itc
 {
-  template <typename T> class cfifo
+  /**
+   * @brief the ring used by cfifo. SPSC must be used with exactly one
+   * producer thread and exactly one consumer thread.
+   **/
+  enum CFifoPolicy
+  {
+    MPMC, SPSC
+  };
+
+  static constexpr size_t cfifo_cacheline_size = 64;
+
+  /**
+   * @brief bounded lock-free MPMC ring (D.Vyukov's sequence-numbered
+   * cells). Every cell carries a sequence number, which tells to the
+   * producers and consumers whose turn it is, so push() fails only if
+   * the ring is full and pop() fails only if the ring is empty.
+   *
+   * The capacity is rounded up to the power of two, every cell is padded
+   * to the cache line.
+   **/
+  template <typename T> class mpmc_ring
   {
   private:
-   
-    struct store_value_type
+    struct alignas(cfifo_cacheline_size) store_value_type
     {
-      std::atomic<bool> can_read;
+      std::atomic<size_t> sequence;
       T data;
-      store_value_type():can_read{false}{}
-      store_value_type(const T& _data):can_read{true},data{_data}{}
-      store_value_type(T&& _data):can_read{true},data{std::move(_data)}{}
+      explicit store_value_type(const size_t seq):sequence{seq},data(){}
       ~store_value_type()=default;
     };
-    
-    using store_type=std::pair<std::atomic_flag,store_value_type>;
-    using storage_type=std::vector<store_type>;
-    
-    size_t                        limit;
+
+    using padding=char[cfifo_cacheline_size];
+
+    const size_t                  limit;
+    const size_t                  mask;
+    store_value_type*             queue;
+    padding                       pad0;
     std::atomic<size_t>           next_push;
+    padding                       pad1;
     std::atomic<size_t>           next_read;
+    padding                       pad2;
+
+    static size_t round_up(const size_t qsz)
+    {
+      size_t result=2;
+      while(result < qsz) result <<= 1;
+      return result;
+    }
+
+  public:
+    explicit mpmc_ring(const size_t qsz)
+    : limit{round_up(qsz)}, mask{limit - 1}, queue{nullptr}, next_push{0}, next_read{0}
+    {
+      void* storage = nullptr;
+      if(posix_memalign(&storage, cfifo_cacheline_size, limit * sizeof(store_value_type)) != 0)
+      {
+        throw std::bad_alloc();
+      }
+      queue = static_cast<store_value_type*>(storage);
+
+      for(size_t i=0;i<limit;++i)
+      {
+        new (&queue[i]) store_value_type(i);
+      }
+    }
+
+    mpmc_ring(mpmc_ring&)=delete;
+    mpmc_ring(const mpmc_ring&)=delete;
+
+    template <typename V> const bool push(V&& data)
+    {
+      store_value_type* cell;
+      size_t pos = next_push.load(std::memory_order_relaxed);
+
+      for(;;)
+      {
+        cell = &queue[pos & mask];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if(dif == 0) // the cell is free on this lap, claim it
+        {
+          if(next_push.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            break;
+          }
+        }else if(dif < 0) // the cell is not consumed yet on the previous lap: full
+        {
+          return false;
+        }else // another producer took the cell
+        {
+          pos = next_push.load(std::memory_order_relaxed);
+        }
+      }
+
+      cell->data = std::forward<V>(data);
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    const bool pop(T& result)
+    {
+      store_value_type* cell;
+      size_t pos = next_read.load(std::memory_order_relaxed);
+
+      for(;;)
+      {
+        cell = &queue[pos & mask];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+        if(dif == 0) // the data is published on this lap, claim it
+        {
+          if(next_read.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            break;
+          }
+        }else if(dif < 0) // nothing is published yet: empty
+        {
+          return false;
+        }else // another consumer took the cell
+        {
+          pos = next_read.load(std::memory_order_relaxed);
+        }
+      }
+
+      result = std::move(cell->data);
+      cell->sequence.store(pos + mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief reserves the run of cells free on this lap (up to n) with a
+     * single CAS and fills it from first.
+     **/
+    template <typename ForwardIterator> const size_t push_n(ForwardIterator first, const size_t n)
+    {
+      size_t pos = next_push.load(std::memory_order_relaxed);
+      size_t count = 0;
+
+      while(n > 0)
+      {
+        intptr_t dif = 0;
+        for(count = 0; count < n; ++count)
+        {
+          const size_t seq = queue[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+          dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + count);
+          if(dif != 0) break;
+        }
+
+        if(count > 0)
+        {
+          if(next_push.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+          {
+            break;
+          }
+        }else if(dif < 0)
+        {
+          return 0;
+        }else
+        {
+          pos = next_push.load(std::memory_order_relaxed);
+        }
+      }
+
+      for(size_t i = 0; i < count; ++i, ++first)
+      {
+        store_value_type& cell = queue[(pos + i) & mask];
+        cell.data = *first;
+        cell.sequence.store(pos + i + 1, std::memory_order_release);
+      }
+      return count;
+    }
+
+    /**
+     * @brief reserves the run of cells published on this lap (up to max)
+     * with a single CAS and moves it to out.
+     **/
+    template <typename OutputIterator> const size_t pop_n(OutputIterator out, const size_t max)
+    {
+      size_t pos = next_read.load(std::memory_order_relaxed);
+      size_t count = 0;
+
+      while(max > 0)
+      {
+        intptr_t dif = 0;
+        for(count = 0; count < max; ++count)
+        {
+          const size_t seq = queue[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+          dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + count + 1);
+          if(dif != 0) break;
+        }
+
+        if(count > 0)
+        {
+          if(next_read.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+          {
+            break;
+          }
+        }else if(dif < 0)
+        {
+          return 0;
+        }else
+        {
+          pos = next_read.load(std::memory_order_relaxed);
+        }
+      }
+
+      for(size_t i = 0; i < count; ++i, ++out)
+      {
+        store_value_type& cell = queue[(pos + i) & mask];
+        *out = std::move(cell.data);
+        cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+      }
+      return count;
+    }
+
+    const size_t capacity() const
+    {
+      return limit;
+    }
+
+    // unreliable but eventually correct
+    const size_t size() const
+    {
+      const size_t read = next_read.load(std::memory_order_relaxed);
+      const size_t pushed = next_push.load(std::memory_order_relaxed);
+      return (pushed > read) ? pushed - read : 0;
+    }
+
+    ~mpmc_ring()
+    {
+      for(size_t i=0;i<limit;++i)
+      {
+        queue[i].~store_value_type();
+      }
+      free(queue);
+    }
+  };
+
+  /**
+   * @brief bounded lock-free SPSC ring. Each side owns its index and keeps
+   * a cached copy of the other side's index, so the other side's cache line
+   * is touched only when the cached copy says the ring is full (empty).
+   * No CAS, only acquire/release.
+   *
+   * The capacity is rounded up to the power of two.
+   **/
+  template <typename T> class spsc_ring
+  {
+  private:
+    using padding=char[cfifo_cacheline_size];
+
+    const size_t                  limit;
+    const size_t                  mask;
+    std::vector<T>                queue;
+    padding                       pad0;
+    std::atomic<size_t>           next_read;   // written by the consumer
+    size_t                        cached_push; // consumer's copy of next_push
+    padding                       pad1;
+    std::atomic<size_t>           next_push;   // written by the producer
+    size_t                        cached_read; // producer's copy of next_read
+    padding                       pad2;
+
+    static size_t round_up(const size_t qsz)
+    {
+      size_t result=2;
+      while(result < qsz) result <<= 1;
+      return result;
+    }
+
+    const size_t free_cells(const size_t pos, const size_t wanted) // producer side
+    {
+      size_t available = limit - (pos - cached_read);
+      if(available < wanted)
+      {
+        cached_read = next_read.load(std::memory_order_acquire);
+        available = limit - (pos - cached_read);
+      }
+      return available;
+    }
+
+    const size_t ready_cells(const size_t pos, const size_t wanted) // consumer side
+    {
+      size_t available = cached_push - pos;
+      if(available < wanted)
+      {
+        cached_push = next_push.load(std::memory_order_acquire);
+        available = cached_push - pos;
+      }
+      return available;
+    }
+
+  public:
+    explicit spsc_ring(const size_t qsz)
+    : limit{round_up(qsz)}, mask{limit - 1}, queue(limit),
+      next_read{0}, cached_push{0}, next_push{0}, cached_read{0}
+    {
+    }
+
+    spsc_ring(spsc_ring&)=delete;
+    spsc_ring(const spsc_ring&)=delete;
+
+    template <typename V> const bool push(V&& data)
+    {
+      const size_t pos = next_push.load(std::memory_order_relaxed);
+      if(free_cells(pos, 1) == 0)
+      {
+        return false;
+      }
+      queue[pos & mask] = std::forward<V>(data);
+      next_push.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    const bool pop(T& result)
+    {
+      const size_t pos = next_read.load(std::memory_order_relaxed);
+      if(ready_cells(pos, 1) == 0)
+      {
+        return false;
+      }
+      result = std::move(queue[pos & mask]);
+      next_read.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    template <typename ForwardIterator> const size_t push_n(ForwardIterator first, const size_t n)
+    {
+      const size_t pos = next_push.load(std::memory_order_relaxed);
+      const size_t count = std::min(n, free_cells(pos, n));
+
+      for(size_t i = 0; i < count; ++i, ++first)
+      {
+        queue[(pos + i) & mask] = *first;
+      }
+      if(count > 0)
+      {
+        next_push.store(pos + count, std::memory_order_release);
+      }
+      return count;
+    }
+
+    template <typename OutputIterator> const size_t pop_n(OutputIterator out, const size_t max)
+    {
+      const size_t pos = next_read.load(std::memory_order_relaxed);
+      const size_t count = std::min(max, ready_cells(pos, max));
+
+      for(size_t i = 0; i < count; ++i, ++out)
+      {
+        *out = std::move(queue[(pos + i) & mask]);
+      }
+      if(count > 0)
+      {
+        next_read.store(pos + count, std::memory_order_release);
+      }
+      return count;
+    }
+
+    const size_t capacity() const
+    {
+      return limit;
+    }
+
+    // unreliable but eventually correct
+    const size_t size() const
+    {
+      const size_t read = next_read.load(std::memory_order_relaxed);
+      const size_t pushed = next_push.load(std::memory_order_relaxed);
+      return (pushed > read) ? pushed - read : 0;
+    }
+  };
+
+  /**
+   * @brief bounded lock-free queue. The ring is selected by the policy:
+   * MPMC (default) serves any number of producers and consumers, SPSC is
+   * cheaper but serves only one producer thread and one consumer thread.
+   *
+   * The blocking send() and recv() spin for a while and then park on a
+   * futex based EventCount. The try_send() and try_recv() stay lock-free,
+   * they do a syscall only if there are parked threads to wake up.
+   **/
+  template <typename T, CFifoPolicy policy = MPMC> class cfifo
+  {
+  private:
+    typedef typename std::conditional<policy == SPSC, spsc_ring<T>, mpmc_ring<T>>::type ring_type;
+    using padding=char[cfifo_cacheline_size];
+
+    ring_type                     ring;
     std::atomic<bool>             valid;
-    std::atomic<int64_t>          depth;
-    storage_type                  queue;
-    
-    
+    const size_t                  spin_limit;
+    padding                       pad0;
+    EventCount                    not_empty;
+    padding                       pad1;
+    EventCount                    not_full;
+
+    template <typename V> const bool push(V&& data)
+    {
+      if(!valid.load(std::memory_order_relaxed)) assert_valid("try_send");
+
+      if(ring.push(std::forward<V>(data)))
+      {
+        not_empty.notify();
+        return true;
+      }
+      return false;
+    }
+
   public:
-   
-   explicit cfifo(const size_t qsz)
-   :  limit{qsz},next_push{0},next_read{0},valid{false}, depth{0}, queue(qsz)
+   typedef T value_type;
+
+   /**
+    * @param qsz - capacity of the queue
+    * @param spin - how many times send()/recv() retry before they park
+    **/
+   explicit cfifo(const size_t qsz, const size_t spin = 256)
+   :  ring(qsz), valid{true}, spin_limit{spin}, not_empty(), not_full()
    {
-/*     static_assert(
-      std::is_trivially_constructible<T>::value || std::is_trivially_constructible<T,T>::value,
-      "itc::cfifo<T>::cfifo(sz), - T must be trivially constructible"
-     );*/
-     
-     // must set all flags to false explicitly, 
-     // because no default static initialization is possible
-     
-     for(size_t i=0;i<limit;++i)
-     {
-       queue[i].first.clear();
-     }
-     valid.store(true);
    }
-   
+
    cfifo(cfifo&)=delete;
    cfifo(const cfifo&)=delete;
-   
+
    const bool try_send(const T& data)
    {
-     // fix on next possible position
-     
-     size_t pos = next_push.load();
-     // skip while valid, next_push is moved by other threads
-     while(assert_valid("try_send")&&(!next_push.compare_exchange_strong(pos,(pos+1) < limit ? pos+1 : 0)))
+     return push(data);
+   }
+
+   const bool try_send(T&& data)
+   {
+     return push(std::move(data));
+   }
+
+   const bool try_recv(T& result)
+   {
+     if(!valid.load(std::memory_order_relaxed)) assert_valid("try_recv");
+
+     if(ring.pop(result))
      {
-       // can't fix on position, getting the next one
-       pos = next_push.load();
+       not_full.notify();
+       return true;
      }
-     
-     // concurrency:
-     // we are safe only until next thread do not try to push at this position
-     // after full pos cycle
-     
-     if(queue[pos].first.test_and_set()) // is tested by another thread
+     return false;
+   }
+
+   /**
+    * @brief sends as many elements of [first,last) as there are free cells
+    * in a row. The whole run of cells is reserved at once (a single CAS
+    * for MPMC, a single release store for SPSC). Use
+    * std::make_move_iterator() to move the elements in.
+    *
+    * @return amount of elements sent, 0 if the queue is full.
+    **/
+   template <typename ForwardIterator> const size_t try_send_n(ForwardIterator first, ForwardIterator last)
+   {
+     if(!valid.load(std::memory_order_relaxed)) assert_valid("try_send_n");
+
+     const size_t count = ring.push_n(first, static_cast<size_t>(std::distance(first, last)));
+
+     if(count > 1)
      {
-       // we may not be sure if it is a producer or consumer 
-       // which we are competing with. So: BAIL OUT!
-       return false;
-     }
-     
-     // we are safe to continue, - this is the testing thread
-     
-     if(queue[pos].second.can_read.load()) // there is the data already!
+       not_empty.notifyAll();
+     }else if(count == 1)
      {
-       // The data are available for consumer to read. So: BAIL OUT!
-       queue[pos].first.clear();
-       return false;
+       not_empty.notify();
      }
-     
-     queue[pos].second.data=data;
-
-     
-     // assign flags in reverse order
-     queue[pos].second.can_read.store(true); 
-     depth.fetch_add(1);
-     queue[pos].first.clear();
-     
-     return true;
+     return count;
    }
-   
-   const bool try_recv(T& result)
+
+   /**
+    * @brief receives up to max elements available in a row into the output
+    * iterator. The whole run of cells is reserved at once.
+    *
+    * @return amount of elements received, 0 if the queue is empty.
+    **/
+   template <typename OutputIterator> const size_t try_recv_n(OutputIterator out, const size_t max)
    {
-     size_t pos=next_read.load();
-     
-     while(assert_valid("try_recv")&&(!next_read.compare_exchange_strong(pos, (pos+1) < limit ? pos+1 : 0)))
+     if(!valid.load(std::memory_order_relaxed)) assert_valid("try_recv_n");
+
+     const size_t count = ring.pop_n(out, max);
+
+     if(count > 1)
+     {
+       not_full.notifyAll();
+     }else if(count == 1)
      {
-       pos = next_read.load();
+       not_full.notify();
      }
-     
-     if(queue[pos].first.test_and_set()) // is tested by another thread
+     return count;
+   }
+
+   void send(const T& data) // blocks until can store the data, while cfifo is valid
+   {
+     for(size_t spin=0; spin < spin_limit; ++spin)
      {
-       // we may not be sure if it is a producer or consumer 
-       // we are competing with. So: BAIL OUT!
-       return false;
+       if(try_send(data)) return;
+       cpu_relax();
      }
-     
-     // we are safe to continue, - this is the testing thread
-     
-     if(queue[pos].second.can_read.load()) // the data available
+     while(!try_send(data))
      {
-       result=std::move(queue[pos].second.data);
-       queue[pos].second.can_read.store(false);
-       queue[pos].first.clear();
-       depth.fetch_sub(1);
-       return true;
+       const uint32_t key=not_full.prepareWait();
+       if(try_send(data))
+       {
+         not_full.cancelWait();
+         return;
+       }
+       if(!valid.load())
+       {
+         not_full.cancelWait();
+         assert_valid("send");
+       }
+       not_full.wait(key);
      }
-     
-     queue[pos].first.clear();
-     return false;
    }
-   
-   void send(const T& data) // blocks until can store the data, while cfifo is valid
+
+   void recv(T& result) // blocks until data is available while cfifo is valid
    {
-     while(!try_send(data));
+     for(size_t spin=0; spin < spin_limit; ++spin)
+     {
+       if(try_recv(result)) return;
+       cpu_relax();
+     }
+     while(!try_recv(result))
+     {
+       const uint32_t key=not_empty.prepareWait();
+       if(try_recv(result))
+       {
+         not_empty.cancelWait();
+         return;
+       }
+       if(!valid.load())
+       {
+         not_empty.cancelWait();
+         assert_valid("recv");
+       }
+       not_empty.wait(key);
+     }
    }
-   
+
    auto recv() // blocks until data is available while cfifo is valid
    {
      T result;
-     while(!try_recv(result));
+     recv(result);
      return std::move(result);
    }
-   
+
    const bool assert_valid(const std::string& func)
    {
      if(!valid.load())
@@ -162,26 +581,31 @@ namespace itc
      }
      return true;
    }
-   
+
+   const size_t capacity() const
+   {
+     return ring.capacity();
+   }
+
    // unreliable but eventually correct
    const bool empty() const
    {
-     return depth.load() <= 0;
+     return size() == 0;
    }
-   
+
    // unreliable but eventually correct
-   const size_t size()
+   const size_t size() const
    {
-     auto ret=depth.load();
-     if(ret>0) return static_cast<size_t>(ret);
-     else return 0;
+     return ring.size();
    }
-   
+
    void shutdown()
    {
      valid.store(false);
+     not_empty.notifyAll();
+     not_full.notifyAll();
    }
-   
+
    ~cfifo()
    {
      shutdown();
@@ -189,4 +613,4 @@ namespace itc
   };
 }
 
-#endif /* __CFIFO_H__ */
\ No newline at end of file
+#endif /* __CFIFO_H__ */
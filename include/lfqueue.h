@@ -0,0 +1,172 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: lfqueue.h 1 2021-03-22 20:41:17Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+#ifndef __LFQUEUE_H__
+#  define __LFQUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <HazardPointers.h>
+
+namespace itc
+{
+  /**
+   * @brief unbounded lock-free MPMC queue (M.Michael and M.Scott), the
+   * removed nodes are reclaimed with hazard pointers. A lock-free
+   * replacement for tsqueue: try_pop() takes the front element atomically,
+   * instead of front() and pop() under separate locks.
+   *
+   * T must be default constructible (the queue keeps a dummy node).
+   **/
+  template <typename T> class lfqueue
+  {
+  private:
+    struct Node
+    {
+      std::atomic<Node*> next;
+      T data;
+
+      explicit Node() : next{nullptr}, data(){}
+      explicit Node(const T& ref) : next{nullptr}, data(ref){}
+      explicit Node(T&& ref) : next{nullptr}, data(std::move(ref)){}
+    };
+
+    std::atomic<Node*>     mHead;
+    char                   pad0[64];
+    std::atomic<Node*>     mTail;
+    char                   pad1[64];
+    std::atomic<ptrdiff_t> mSize;
+
+    void enqueue(Node* node)
+    {
+      HazardPointers& hp=HazardPointers::instance();
+
+      for(;;)
+      {
+        Node* tail=hp.protect(0, mTail);
+        Node* next=tail->next.load(std::memory_order_acquire);
+
+        if(tail != mTail.load(std::memory_order_acquire))
+          continue;
+
+        if(next == nullptr)
+        {
+          if(tail->next.compare_exchange_weak(next, node, std::memory_order_release, std::memory_order_relaxed))
+          {
+            mTail.compare_exchange_strong(tail, node, std::memory_order_release, std::memory_order_relaxed);
+            break;
+          }
+        }else // the tail is lagging behind, help to move it
+        {
+          mTail.compare_exchange_strong(tail, next, std::memory_order_release, std::memory_order_relaxed);
+        }
+      }
+      hp.clear(0);
+      ++mSize;
+    }
+
+  public:
+    typedef T value_type;
+
+    explicit lfqueue() : mHead{nullptr}, mTail{nullptr}, mSize{0}
+    {
+      Node* dummy=new Node();
+      mHead.store(dummy);
+      mTail.store(dummy);
+    }
+
+    lfqueue(const lfqueue&)=delete;
+    lfqueue(lfqueue&)=delete;
+
+    ~lfqueue()
+    {
+      Node* node=mHead.load();
+      while(node != nullptr)
+      {
+        Node* next=node->next.load();
+        delete node;
+        node=next;
+      }
+    }
+
+    const lfqueue& push(const T& ref)
+    {
+      enqueue(new Node(ref));
+      return *this;
+    }
+
+    const lfqueue& push(T&& ref)
+    {
+      enqueue(new Node(std::move(ref)));
+      return *this;
+    }
+
+    /**
+     * @brief takes the front element, if any.
+     * @return false if the queue is empty.
+     **/
+    const bool try_pop(T& result)
+    {
+      HazardPointers& hp=HazardPointers::instance();
+
+      for(;;)
+      {
+        Node* head=hp.protect(0, mHead);
+        Node* tail=mTail.load(std::memory_order_acquire);
+        Node* next=hp.protect(1, head->next);
+
+        if(head != mHead.load(std::memory_order_acquire))
+          continue;
+
+        if(next == nullptr)
+        {
+          hp.clear(0);
+          hp.clear(1);
+          return false;
+        }
+
+        if(head == tail) // the tail is lagging behind, help to move it
+        {
+          mTail.compare_exchange_strong(tail, next, std::memory_order_release, std::memory_order_relaxed);
+          continue;
+        }
+
+        if(mHead.compare_exchange_strong(head, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+          // next is the new dummy, only the winner of the CAS touches its data
+          result=std::move(next->data);
+          hp.clear(0);
+          hp.clear(1);
+          --mSize;
+          hp.retire(head);
+          return true;
+        }
+      }
+    }
+
+    // unreliable but eventually correct (a pop may be counted before its push)
+    const size_t size() const
+    {
+      const ptrdiff_t result=mSize.load(std::memory_order_relaxed);
+      return (result > 0) ? size_t(result) : 0;
+    }
+
+    // unreliable but eventually correct
+    const bool empty() const
+    {
+      return size() == 0;
+    }
+  };
+}
+
+#endif /* __LFQUEUE_H__ */
@@ -14,80 +14,289 @@
 #  define	__TSBQUEUE_H__
 
 #include <queue>
-#include <sys/PosixSemaphore.h>
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <functional>
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+#include <system_error>
 #include <sys/synclock.h>
 #include <mutex>
 #include <sys/mutex.h>
-#include <sys/semaphore.h>
 #include <Val2Type.h>
+#include <EventCount.h>
+#include <RingQueue.h>
 
 namespace itc
 {
   /**
-   * @brief thread safe blocking queue. 
+   * @brief thread safe blocking queue.
+   *
+   * The consumers park on a futex based EventCount. A send costs one wake
+   * per call (not per element), and no syscall at all if no consumer is
+   * sleeping. A consumer which leaves the queue non-empty passes the
+   * wake to the next sleeping consumer.
+   *
+   * The queue is unbounded by default. With a capacity, the blocking
+   * send() waits for space, the timed try_send() waits for space until
+   * the deadline and the non-blocking try_send() fails when the queue is
+   * full. The high-water-mark callback is invoked by the producer, whose
+   * send makes the depth reach the mark from below.
    */
   template <typename DataType, typename MutexType=std::mutex> class tsbqueue
   {
   public:
      enum QCopyPolicy { SWAP, COPY };
      typedef DataType value_type;
+     typedef std::function<void(const size_t)> HighWaterMarkCallback;
   private:
-   using semaphore=itc::sys::semaphore;
-   
    MutexType             mMutex;
-   std::queue<DataType>  mQueue;
+   RingQueue<DataType>   mQueue;
    std::atomic<size_t>   mQueueDepth;
-   semaphore             mEvent;
-   
-   
-   void recv(std::queue<DataType>& out, ::itc::utils::Int2Type<SWAP> swap)
-    {
-      mEvent.wait();
-      
-      std::lock_guard<MutexType> sync(mMutex);
+   std::atomic<bool>     mValid;
+   const size_t          mCapacity;
+   size_t                mHighWaterMark;
+   HighWaterMarkCallback mOnHighWaterMark;
+   EventCount            mEvent;
+   EventCount            mNotFull;
+   EventCount*           mListener;
 
-      if(mQueue.empty()) 
-        throw std::logic_error("tbsqueue<T>::recv(std::queue<DataType>&) - already consumed");
+   void assertValid(const char* func)
+   {
+     if(!mValid.load())
+     {
+       throw std::system_error(EIDRM,std::system_category(),std::string("tsbqueue<T>::")+func+"() - queue is being removed");
+     }
+   }
 
-      mEvent.sub(mQueue.size()-1);
+   /**
+    * @brief blocks until the queue looks non-empty or is destroyed.
+    **/
+   void waitForData(const char* func)
+   {
+     while(mQueueDepth.load() == 0)
+     {
+       assertValid(func);
+       const uint32_t key=mEvent.prepareWait();
+       if((mQueueDepth.load() > 0)||(!mValid.load()))
+       {
+         mEvent.cancelWait();
+         continue;
+       }
+       mEvent.wait(key);
+     }
+   }
 
-      std::swap(mQueue,out);
-      
-      mQueueDepth.store(0);
-    }
-    
-    void recv(std::queue<DataType>& out, ::itc::utils::Int2Type<COPY> swap)
-    {
-      mEvent.wait();
-      std::lock_guard<MutexType> sync(mMutex);
+   /**
+    * @brief same as waitForData() with an absolute CLOCK_REALTIME deadline.
+    **/
+   const bool waitForData(const char* func, const ::timespec& timeout)
+   {
+     while(mQueueDepth.load() == 0)
+     {
+       assertValid(func);
+       const uint32_t key=mEvent.prepareWait();
+       if((mQueueDepth.load() > 0)||(!mValid.load()))
+       {
+         mEvent.cancelWait();
+         continue;
+       }
+       if(!mEvent.wait(key,timeout))
+       {
+         return mQueueDepth.load() > 0;
+       }
+     }
+     return true;
+   }
 
-      if(mQueue.empty()) 
-        throw std::logic_error("tbsqueue<T>::recv(std::queue<DataType>&) - already consumed");
+   const bool full() const
+   {
+     return (mCapacity > 0)&&(mQueueDepth.load() >= mCapacity);
+   }
 
-      mEvent.sub(mQueue.size()-1);
+   /**
+    * @brief blocks until the queue has space or is destroyed.
+    **/
+   void waitForSpace(const char* func)
+   {
+     while(full())
+     {
+       assertValid(func);
+       const uint32_t key=mNotFull.prepareWait();
+       if((!full())||(!mValid.load()))
+       {
+         mNotFull.cancelWait();
+         continue;
+       }
+       mNotFull.wait(key);
+     }
+   }
 
-      while(!mQueue.empty())
-      {
-        out.push(std::move(mQueue.front()));
-        mQueue.pop();
-      }
-      mQueueDepth.store(0);
-    }
+   /**
+    * @brief same as waitForSpace() with an absolute CLOCK_REALTIME deadline.
+    **/
+   const bool waitForSpace(const char* func, const ::timespec& timeout)
+   {
+     while(full())
+     {
+       assertValid(func);
+       const uint32_t key=mNotFull.prepareWait();
+       if((!full())||(!mValid.load()))
+       {
+         mNotFull.cancelWait();
+         continue;
+       }
+       if(!mNotFull.wait(key,timeout))
+       {
+         return !full();
+       }
+     }
+     return true;
+   }
+
+   /**
+    * @brief pushes up to n elements, as many as fit. The caller must hold
+    * the mutex.
+    *
+    * @return amount of elements pushed, depth before the push in before.
+    **/
+   template <typename Iterator> const size_t push(Iterator first, const size_t n, size_t& before)
+   {
+     before=mQueueDepth.load();
+
+     const size_t count=(mCapacity == 0) ? n : std::min(n, mCapacity - std::min(before, mCapacity));
+
+     for(size_t i=0;i<count;++i,++first)
+     {
+       mQueue.push(std::move(*first));
+     }
+     mQueueDepth.fetch_add(count);
+     if((count > 0)&&(mListener != nullptr))
+       mListener->notify();
+     return count;
+   }
+
+   /**
+    * @brief wakes a consumer and reports the high-water-mark crossing,
+    * must be called after the mutex is released.
+    **/
+   void pushed(const size_t before, const size_t count)
+   {
+     if(count == 0) return;
+
+     signal();
+
+     if(mOnHighWaterMark&&(before < mHighWaterMark)&&(before + count >= mHighWaterMark))
+     {
+       mOnHighWaterMark(before + count);
+     }
+   }
+
+   void popped(const bool all)
+   {
+     if(mCapacity == 0) return;
+
+     if(all)
+       mNotFull.notifyAll();
+     else
+       mNotFull.notify();
+   }
+
+   /**
+    * @brief takes one element if available. Wakes another consumer if
+    * there is more data left.
+    **/
+   const bool take(DataType& result)
+   {
+     bool more=false;
+     {
+       std::lock_guard<MutexType> sync(mMutex);
+       if(mQueue.empty())
+         return false;
+
+       result=std::move(mQueue.front());
+       mQueue.pop();
+       more=(mQueueDepth.fetch_sub(1) > 1);
+       if(more&&(mListener != nullptr))
+         mListener->notify();
+     }
+     if(more)
+       mEvent.notify();
+     popped(false);
+     return true;
+   }
+
+   void signal()
+   {
+     mEvent.notify();
+   }
+
+   /**
+    * @brief hands the whole ring to the consumer. The consumer's empty ring
+    * becomes the queue storage, so two rings passed back and forth are
+    * reused without allocations.
+    **/
+   void drain(RingQueue<DataType>& out, ::itc::utils::Int2Type<SWAP> swap)
+   {
+     if(out.empty())
+     {
+       mQueue.swap(out);
+     }
+     else
+     {
+       drain(out, ::itc::utils::Int2Type<COPY>{});
+     }
+   }
+
+   template <typename Queue, typename Policy> void drain(Queue& out, Policy policy)
+   {
+     while(!mQueue.empty())
+     {
+       out.push(std::move(mQueue.front()));
+       mQueue.pop();
+     }
+   }
+
+   template <typename Queue, typename Policy> void recvAll(Queue& out, Policy policy)
+   {
+     for(;;)
+     {
+       waitForData("recv");
+       {
+         std::lock_guard<MutexType> sync(mMutex);
+
+         if(mQueue.empty())
+           continue;
+
+         drain(out, policy);
+         mQueueDepth.store(0);
+       }
+       popped(true);
+       return;
+     }
+   }
 
    void destroy()
    {
-     mEvent.destroy();
+     shutdown();
      std::lock_guard<MutexType> sync(mMutex);
-     std::queue<DataType> aQueue;
-     std::swap(mQueue,aQueue);
+     mQueue.clear();
      mQueueDepth=0;
    }
-   
+
   public:
-   explicit tsbqueue():mMutex(),mQueue(),mQueueDepth{0},mEvent{10}{};
+   /**
+    * @param capacity - max depth of the queue, 0 for unbounded
+    **/
+   explicit tsbqueue(const size_t capacity=0)
+   : mMutex(),mQueue(),mQueueDepth{0},mValid{true},mCapacity(capacity),
+     mHighWaterMark(std::numeric_limits<size_t>::max()),mOnHighWaterMark(),
+     mEvent(),mNotFull(),mListener(nullptr){};
    tsbqueue(const tsbqueue&)=delete;
    tsbqueue(tsbqueue&)=delete;
-   
+
    ~tsbqueue()
    {
      destroy();
@@ -99,54 +308,93 @@ namespace itc
     */
     void send(const std::vector<DataType>& ref)
     {
-      std::lock_guard<MutexType> sync(mMutex);
-      for(size_t i=0;i<ref.size();++i)
+      size_t sent=0;
+      while(sent < ref.size())
       {
-        mQueue.push(std::move(ref[i]));
-        if(!mEvent.post())
+        waitForSpace("send");
+
+        size_t before=0;
+        size_t count=0;
         {
-          throw std::system_error(errno,std::system_category(),"Can't increment semaphore, system is going down or semaphore error");
+          std::lock_guard<MutexType> sync(mMutex);
+          assertValid("send");
+          count=push(ref.begin()+sent, ref.size()-sent, before);
         }
+        pushed(before, count);
+        sent+=count;
       }
-      mQueueDepth.fetch_add(ref.size());
     }
-    
+
+    /**
+     * @brief sends the message, unless the mutex is busy or the queue is full.
+     **/
     const bool try_send(const DataType&& ref)
     {
       if(mMutex.try_lock())
       {
-        mQueue.push(std::move(ref));
-        
-        if(!mEvent.post())
+        if(!mValid.load())
         {
-          throw std::system_error(errno,std::system_category(),"Can't increment semaphore, system is going down or semaphore error");
+          mMutex.unlock();
+          assertValid("try_send");
         }
-        ++mQueueDepth;
+        size_t before=0;
+        const size_t count=push(&ref, 1, before);
         mMutex.unlock();
-        return true;
+        pushed(before, count);
+        return count == 1;
       }
       return false;
     }
-    
+
+    /**
+     * @brief sends all the messages, unless the mutex is busy or there is
+     * no space for all of them.
+     **/
     const bool try_send(const std::vector<DataType>& ref)
     {
       if(mMutex.try_lock())
       {
-        for(size_t i=0;i<ref.size();++i)
+        if(!mValid.load())
         {
-          mQueue.push(std::move(ref[i]));
-          if(!mEvent.post())
-          {
-            throw std::system_error(errno,std::system_category(),"Can't increment semaphore, system is going down or semaphore error");
-          }
-          mQueueDepth.fetch_add(ref.size());
+          mMutex.unlock();
+          assertValid("try_send");
         }
+        if((mCapacity > 0)&&(mQueueDepth.load() + ref.size() > mCapacity))
+        {
+          mMutex.unlock();
+          return false;
+        }
+        size_t before=0;
+        const size_t count=push(ref.begin(), ref.size(), before);
         mMutex.unlock();
+        pushed(before, count);
         return true;
       }
       return false;
     }
-    
+
+    /**
+     * @brief sends the message, waiting for space until the absolute
+     * CLOCK_REALTIME timeout.
+     **/
+    const bool try_send(const DataType&& ref, const ::timespec& timeout)
+    {
+      while(waitForSpace("try_send",timeout))
+      {
+        size_t before=0;
+        size_t count=0;
+        {
+          std::lock_guard<MutexType> sync(mMutex);
+          assertValid("try_send");
+          count=push(&ref, 1, before);
+        }
+        pushed(before, count);
+        if(count == 1)
+          return true;
+      }
+      return false;
+    }
+
    /**
     * @brief send message of DataType to the queue.
     * @param ref message to be sent.
@@ -154,84 +402,141 @@ namespace itc
     */
     void send(const DataType&& ref)
     {
-      std::lock_guard<MutexType> sync(mMutex);
-      mQueue.push(std::move(ref));
-      if(!mEvent.post())
+      for(;;)
       {
-        throw std::system_error(errno,std::system_category(),"Can't increment semaphore, system is going down or semaphore error");
+        waitForSpace("send");
+
+        size_t before=0;
+        size_t count=0;
+        {
+          std::lock_guard<MutexType> sync(mMutex);
+          assertValid("send");
+          count=push(&ref, 1, before);
+        }
+        pushed(before, count);
+        if(count == 1)
+          return;
       }
-      ++mQueueDepth;
     }
-    
+
+    /**
+     * @brief receive a message, waiting for it until the absolute
+     * CLOCK_REALTIME timeout (same as sem_timedwait()).
+     **/
     const bool try_recv(DataType& result,const ::timespec& timeout)
     {
-      if(mEvent.timed_wait(timeout))
+      while(waitForData("try_recv",timeout))
       {
-        std::lock_guard<MutexType> sync(mMutex);
-        result=std::move(mQueue.front());
-        mQueue.pop();
-        --mQueueDepth;
-        return true;
+        if(take(result))
+          return true;
       }
       return false;
     }
-    
+
     const bool try_recv(DataType& result)
     {
-      if(mEvent.try_wait())
+      if(mQueueDepth.load() > 0)
       {
-        std::lock_guard<MutexType> sync(mMutex);
-        result=std::move(mQueue.front());
-        mQueue.pop();
-        --mQueueDepth;
-        return true;
+        return take(result);
       }
       return false;
     }
-    
+
     /**
-     * @brief receive a message from queue as it is available. This method will 
-     * block until the semaphore is triggered. If message is already consumed
-     * by another thread (the queue is empty), an exception will be thrown.
-     * 
+     * @brief receive a message from queue as it is available. This method will
+     * block until the data is available. If the queue is destroyed while
+     * waiting, std::system_error(EIDRM) will be thrown.
+     *
      **/
     void recv(DataType& result)
     {
-      mEvent.wait();
-      std::lock_guard<MutexType> sync(mMutex);
-
-      if(mQueue.empty()) 
-        throw std::logic_error("tbsqueue<T>::recv(T&) - already consumed");
-      
-      result=std::move(mQueue.front());
-      mQueue.pop();
-      --mQueueDepth;
+      do
+      {
+        waitForData("recv");
+      }while(!take(result));
     }
-    
+
     auto recv()
     {
-      mEvent.wait();
-      std::lock_guard<MutexType> sync(mMutex);
-
-      if(mQueue.empty()) 
-        throw std::logic_error("tbsqueue<T>::recv() - already consumed");
-
-      auto result=std::move(mQueue.front());
-      mQueue.pop();
-      --mQueueDepth;
+      DataType result;
+      recv(result);
       return result;
     }
-    
+
+    /**
+     * @brief receive all available messages. The ring storage can't be
+     * swapped with std::queue, so SWAP moves the messages as COPY does.
+     **/
     template < const QCopyPolicy policy > void recv(std::queue<DataType>& out)
     {
-      recv(out,::itc::utils::Int2Type<policy>{});
+      recvAll(out,::itc::utils::Int2Type<COPY>{});
     }
-    
+
+    /**
+     * @brief receive all available messages. SWAP into an empty ring
+     * exchanges the buffers instead of moving the messages.
+     **/
+    template < const QCopyPolicy policy > void recv(RingQueue<DataType>& out)
+    {
+      recvAll(out,::itc::utils::Int2Type<policy>{});
+    }
+
     const size_t size() const
     {
       return mQueueDepth;
     }
-    
+
+    /**
+     * @brief wakes up all blocked consumers and producers with
+     * std::system_error(EIDRM). The following sends throw it too, the
+     * following blocking recvs throw it once the queue is empty.
+     **/
+    void shutdown()
+    {
+      mValid.store(false);
+      mEvent.notifyAll();
+      mNotFull.notifyAll();
+    }
+
+    /**
+     * @return max depth of the queue, 0 if unbounded.
+     **/
+    const size_t capacity() const
+    {
+      return mCapacity;
+    }
+
+    /**
+     * @brief the listener is notified along with the consumers each time
+     * the data is sent to the queue (see QueueWaitSet). Only one listener
+     * may be attached at a time. The listener is notified under the mutex,
+     * so after detach() returns it is not touched anymore.
+     **/
+    void attach(EventCount* listener)
+    {
+      std::lock_guard<MutexType> sync(mMutex);
+      if((mListener != nullptr)&&(listener != nullptr)&&(mListener != listener))
+        throw std::logic_error("tsbqueue<T>::attach() - the queue is already attached to another listener");
+      mListener=listener;
+    }
+
+    void detach()
+    {
+      attach(nullptr);
+    }
+
+    /**
+     * @brief installs the callback, invoked with the current depth each
+     * time the depth reaches the mark from below. Install it before the
+     * queue is shared between threads.
+     **/
+    void setHighWaterMark(const size_t mark, const HighWaterMarkCallback& callback)
+    {
+      std::lock_guard<MutexType> sync(mMutex);
+      mHighWaterMark=mark;
+      mOnHighWaterMark=callback;
+    }
+
     const bool empty() const
     {
       return mQueueDepth.load() == 0;
@@ -239,4 +544,3 @@ namespace itc
   };
 }
 #endif	/* __TSBQUEUE_H__ */
-
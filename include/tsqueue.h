@@ -17,17 +17,21 @@
 #include <memory>
 #include <mutex>
 #include <sys/synclock.h>
+#include <RingQueue.h>
 /**
  * @brief thread safe STL queue. It is the same STL <queue> just protected by 
- * mutexes against data race
+ * mutexes against data race. The elements are stored in itc::RingQueue, which
+ * reuses its memory once the queue has seen its peak depth.
  **/
 template <typename T> class tsqueue
 {
 private:
   std::mutex mMutex;
-  std::queue<T> mQueue;
+  itc::RingQueue<T> mQueue;
 public:
-  explicit tsqueue():mMutex(){}
+  typedef T value_type;
+
+  explicit tsqueue():mMutex(),mQueue(){}
   
   const bool empty()
   {
@@ -49,13 +53,21 @@ public:
     return *this;
   }
   
-  const T& front()
+  /**
+   * @brief copies the front element under the lock. A reference would
+   * dangle once a concurrent push() grows the ring, use try_pop() to take
+   * the element instead.
+   **/
+  T front()
   {
     STDSyncLock sync(mMutex);
     return mQueue.front();
   }
   
-  const T& top()
+  /**
+   * @brief same as front().
+   **/
+  T top()
   {
     STDSyncLock sync(mMutex);
     return mQueue.front();
@@ -68,6 +80,21 @@ public:
     return *this;
   }
   
+  /**
+   * @brief takes the front element under a single lock. Unlike front() and
+   * pop(), it is safe with several consumers.
+   * @return false if the queue is empty.
+   **/
+  const bool try_pop(T& result)
+  {
+    STDSyncLock sync(mMutex);
+    if(mQueue.empty())
+      return false;
+    result=std::move(mQueue.front());
+    mQueue.pop();
+    return true;
+  }
+  
   const size_t size()
   {
     STDSyncLock sync(mMutex);
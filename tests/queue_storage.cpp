@@ -0,0 +1,200 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: queue_storage.cpp 1 2021-04-10 12:20:31Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief checks that tsbqueue and tsqueue stop allocating once they have
+ * seen their peak depth, and that RingQueue survives pushing a reference
+ * to its own element while it grows.
+ **/
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <tsbqueue.h>
+#include <tsqueue.h>
+#include <RingQueue.h>
+
+namespace
+{
+  std::atomic<bool> counting{false};
+  std::atomic<long> allocations{0};
+
+  int failures = 0;
+
+  void check(const bool condition, const char* what, const long value)
+  {
+    std::printf("%-56s %s (%ld)\n", what, condition ? "ok" : "FAILED", value);
+    if(!condition) ++failures;
+  }
+
+  struct Message
+  {
+    uint64_t id;
+    uint64_t payload[3];
+  };
+
+  const size_t BURST = 1000;
+  const size_t ROUNDS = 100;
+
+  /**
+   * @brief bursts of BURST sends, half of them received one by one and the
+   * rest in bulk, the depth never exceeds BURST.
+   **/
+  void tsbqueueBursts(itc::tsbqueue<Message>& queue, itc::RingQueue<Message>& out)
+  {
+    Message msg{};
+    for(size_t round = 0; round < ROUNDS; ++round)
+    {
+      for(size_t i = 0; i < BURST; ++i)
+      {
+        msg.id = i;
+        queue.send(std::move(msg));
+      }
+      for(size_t i = 0; i < BURST / 2; ++i)
+      {
+        queue.recv(msg);
+      }
+      queue.recv<itc::tsbqueue<Message>::SWAP>(out);
+      out.clear();
+    }
+  }
+
+  void tsqueueBursts(tsqueue<Message>& queue)
+  {
+    Message msg{};
+    for(size_t round = 0; round < ROUNDS; ++round)
+    {
+      for(size_t i = 0; i < BURST; ++i)
+      {
+        msg.id = i;
+        queue.push(msg);
+      }
+      while(queue.try_pop(msg));
+    }
+  }
+
+  /**
+   * @brief a producer and a consumer thread on a bounded queue, counted
+   * after their warm-up only.
+   **/
+  const long producerConsumer()
+  {
+    const size_t capacity = 256;
+    const size_t messages = 200000;
+
+    itc::tsbqueue<Message> queue(capacity);
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+
+    auto produce = [&](){
+      Message msg{};
+      for(size_t i = 0; i < capacity; ++i) queue.send(std::move(msg));
+      ++ready;
+      while(!go) std::this_thread::yield();
+      for(size_t i = 0; i < messages; ++i)
+      {
+        msg.id = i;
+        queue.send(std::move(msg));
+      }
+    };
+    auto consume = [&](){
+      Message msg{};
+      for(size_t i = 0; i < capacity; ++i) queue.recv(msg);
+      ++ready;
+      while(!go) std::this_thread::yield();
+      for(size_t i = 0; i < messages; ++i) queue.recv(msg);
+    };
+
+    std::thread producer(produce), consumer(consume);
+    while(ready < 2) std::this_thread::yield();
+
+    const long before = allocations;
+    counting = true;
+    go = true;
+    producer.join();
+    consumer.join();
+    counting = false;
+    return allocations - before;
+  }
+}
+
+// not inlined, so the compiler does not pair the malloc() and free() with
+// the new and delete expressions in the queues
+__attribute__((noinline)) void* operator new(size_t size)
+{
+  if(counting.load(std::memory_order_relaxed)) ++allocations;
+  void* ptr = std::malloc(size);
+  if(ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept
+{
+  std::free(ptr);
+}
+
+int main()
+{
+  {
+    itc::tsbqueue<Message> queue;
+    itc::RingQueue<Message> out;
+    tsbqueueBursts(queue, out); // warm-up
+
+    counting = true;
+    const long before = allocations;
+    tsbqueueBursts(queue, out);
+    const long result = allocations - before;
+    counting = false;
+    check(result == 0, "tsbqueue: no allocations in steady-state bursts", result);
+  }
+  {
+    tsqueue<Message> queue;
+    tsqueueBursts(queue); // warm-up
+
+    counting = true;
+    const long before = allocations;
+    tsqueueBursts(queue);
+    const long result = allocations - before;
+    counting = false;
+    check(result == 0, "tsqueue: no allocations in steady-state bursts", result);
+  }
+  {
+    const long result = producerConsumer();
+    check(result == 0, "tsbqueue: no allocations producer/consumer at capacity", result);
+  }
+  {
+    itc::RingQueue<std::string> ring(2);
+    ring.push(std::string(64, 'a'));
+    size_t pushed = 1;
+    for(size_t i = 0; i < 10; ++i)
+    {
+      ring.push(ring.front()); // the ring grows when i is 0, 2, 6
+      ++pushed;
+    }
+    bool intact = (ring.size() == pushed);
+    while(!ring.empty())
+    {
+      intact = intact && (ring.front() == std::string(64, 'a'));
+      ring.pop();
+    }
+    check(intact, "RingQueue: push of its own front while growing", long(pushed));
+  }
+  return failures == 0 ? 0 : 1;
+}
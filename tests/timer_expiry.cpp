@@ -0,0 +1,148 @@
+/**
+ * Copyright Pavel Kraynyukhov 2007 - 2021.
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file LICENSE_1_0.txt or copy at
+ *          http://www.boost.org/LICENSE_1_0.txt)
+ *
+ * $Id: timer_expiry.cpp 1 2021-04-10 17:31:12Z pk $
+ *
+ * EMail: pavel.kraynyukhov@gmail.com
+ *
+ **/
+
+/**
+ * @brief 100k co-expiring timers: the timer queues hand all of them out in
+ * one expire() call, and RScheduler runs every one of them, none early,
+ * in one burst after their common offset.
+ **/
+
+#include <unistd.h>
+#include <time.h>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <RScheduler.h>
+#include <TimerMap.h>
+#include <TimerWheel.h>
+
+namespace
+{
+  const size_t TIMERS = 100000;
+  const uint32_t OFFSET_MS = 200;
+
+  int failures = 0;
+
+  void check(const bool condition, const char* what, const long value)
+  {
+    std::printf("%-66s %s (%ld)\n", what, condition ? "ok" : "FAILED", value);
+    if(!condition) ++failures;
+  }
+
+  const uint64_t now()
+  {
+    ::timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+  }
+
+  std::atomic<size_t>   fired{0};
+  std::atomic<uint64_t> lastFired{0};
+  std::atomic<size_t>   early{0};
+
+  struct Job : public ::itc::abstract::IRunnable
+  {
+    uint64_t due;
+
+    explicit Job(const uint64_t deadline) : due(deadline){}
+
+    void execute()
+    {
+      const uint64_t current = now();
+      // the wheel rounds up to its tick, 1ms covers the clock granularity
+      if(current + 1000000 < due) ++early;
+      uint64_t last = lastFired.load();
+      while((current > last)&&(!lastFired.compare_exchange_weak(last, current)));
+      ++fired;
+    }
+
+    void onCancel(){}
+    void shutdown(){}
+  };
+
+  void queue(::itc::abstract::ITimerQueue<size_t>& timers, const char* name)
+  {
+    const uint64_t deadline = 1000000000;
+    std::vector<uint64_t> ids;
+    ids.reserve(TIMERS);
+    for(size_t i = 0; i < TIMERS; ++i)
+    {
+      ids.push_back(timers.insert(deadline, i));
+    }
+    for(size_t i = 0; i < TIMERS; i += 10)
+    {
+      timers.cancel(ids[i]);
+    }
+
+    std::vector<size_t> out;
+    timers.expire(deadline - 1, out);
+    const size_t before = out.size();
+    timers.expire(deadline, out);
+
+    std::string what = std::string(name) + ": one expire() returns all co-expiring timers";
+    check((before == 0)&&(out.size() == TIMERS - TIMERS / 10)&&timers.empty(), what.c_str(), long(out.size()));
+  }
+
+  void scheduler(const ::itc::RScheduler::TimerBackend backend, const char* name)
+  {
+    fired = 0;
+    lastFired = 0;
+    early = 0;
+
+    auto rs = std::make_shared<::itc::RScheduler>(4, 5, backend);
+    std::thread thread([&rs](){ rs->execute(); });
+
+    std::vector<std::shared_ptr<Job>> jobs;
+    jobs.reserve(TIMERS);
+    for(size_t i = 0; i < TIMERS; ++i)
+    {
+      jobs.push_back(std::make_shared<Job>(now() + uint64_t(OFFSET_MS) * 1000000));
+      rs->add(OFFSET_MS, jobs.back());
+    }
+    const uint64_t lastDue = jobs.back()->due;
+
+    for(size_t i = 0; (i < 10000)&&(fired < TIMERS); ++i)
+      usleep(1000);
+
+    rs->onCancel();
+    thread.join();
+
+    std::string what = std::string(name) + ": all timers fired";
+    check(fired == TIMERS, what.c_str(), long(fired));
+    what = std::string(name) + ": no timer fired early";
+    check(early == 0, what.c_str(), long(early));
+    // the burst is dispatched as one batch, the last one runs soon after
+    // the last deadline; 1s is far from the 100k * yield of a per-task
+    // dispatch, but tolerant to a loaded machine
+    const long lateMs = long((std::max(lastFired.load(), lastDue) - lastDue) / 1000000);
+    what = std::string(name) + ": last timer late by less than 1000 ms";
+    check(lateMs < 1000, what.c_str(), lateMs);
+  }
+}
+
+int main()
+{
+  {
+    ::itc::TimerMap<size_t> timers;
+    queue(timers, "TimerMap");
+  }
+  {
+    ::itc::TimerWheel<size_t> timers(100000);
+    queue(timers, "TimerWheel");
+  }
+  scheduler(::itc::RScheduler::TIMER_MAP, "RScheduler TIMER_MAP");
+  scheduler(::itc::RScheduler::TIMER_WHEEL, "RScheduler TIMER_WHEEL");
+  return failures == 0 ? 0 : 1;
+}